@@ -0,0 +1,624 @@
+/** \file   bench.c
+ * \brief   Benchmark program for the joystick API hot paths
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Runs the benchmarks registered in the \c bench_*_list arrays, either all of
+ * them or only the ones whose names are given on the command line.
+ *
+ * Each benchmark is run \c --repeat times and the mean, standard deviation
+ * and minimum of the time per operation are reported. The results can be
+ * written to a CSV file with \c --output and compared against such a file,
+ * for example one made on another commit, with \c --compare.
+ *
+ * Benchmarks that run at a set rate report the rate they achieved instead,
+ * which isn't a cost per operation and is left out of the CSV file.
+ *
+ * The benchmarks don't touch any host devices: devices are created with
+ * \c bench_device_new() and the arch-specific functions of the joystick API
+ * are implemented as no-ops below.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <math.h>
+#ifdef WINDOWS_COMPILE
+#include <windows.h>
+#endif
+
+#include "cmdline.h"
+#include "joyapi.h"
+#include "joymap.h"
+#include "lib.h"
+
+#include "bench.h"
+
+
+/** \brief  Enable debug message */
+bool debug = false;
+
+/** \brief  Enable more verbose output */
+bool verbose = false;
+
+static bool  opt_list        = false;
+static int   opt_iterations  = 1000000;
+static int   opt_repeat      = 5;
+static char *opt_output_file = NULL;
+static char *opt_compare_file = NULL;
+
+static const cmdline_opt_t options[] = {
+    {   .type       = CMDLINE_BOOLEAN,
+        .long_name  = "list",
+        .target     = &opt_list,
+        .help       = "list available benchmarks"
+    },
+    {   .type       = CMDLINE_INTEGER,
+        .short_name = 'n',
+        .long_name  = "iterations",
+        .target     = &opt_iterations,
+        .param      = "count",
+        .help       = "set number of iterations per benchmark"
+    },
+    {   .type       = CMDLINE_INTEGER,
+        .short_name = 'r',
+        .long_name  = "repeat",
+        .target     = &opt_repeat,
+        .param      = "count",
+        .help       = "run each benchmark count times (default 5)"
+    },
+    {   .type       = CMDLINE_STRING,
+        .short_name = 'o',
+        .long_name  = "output",
+        .target     = &opt_output_file,
+        .param      = "filename",
+        .help       = "write results to CSV file"
+    },
+    {   .type       = CMDLINE_STRING,
+        .long_name  = "compare",
+        .target     = &opt_compare_file,
+        .param      = "filename",
+        .help       = "compare results with CSV file written by --output"
+    },
+    {   .type       = CMDLINE_BOOLEAN,
+        .short_name = 'v',
+        .long_name  = "verbose",
+        .target     = &verbose,
+        .help       = "print extra information per benchmark run"
+    },
+    CMDLINE_OPTIONS_END
+};
+
+/** \brief  All benchmark lists */
+static const bench_t *bench_lists[] = {
+    bench_events_list,
+    bench_lookup_list,
+    bench_synth_list,
+    bench_vjm_list,
+    NULL
+};
+
+/** \brief  State of the pseudo random number generator */
+static uint32_t random_state = 0x2545f491u;
+
+/** \brief  Results of a benchmark case over all runs */
+typedef struct bench_result_s {
+    char     *name;         /**< name of case */
+    uint64_t  ops;          /**< operations in last run */
+    uint64_t  bytes;        /**< bytes processed in last run (0 = none) */
+    double    target;       /**< target operations per second of a rate
+                                 result (0 = not a rate result) */
+    uint64_t  dropped;      /**< port updates dropped in all runs */
+    double   *samples;      /**< nanoseconds per operation of each run, or
+                                 operations per second for a rate result */
+    int       num_samples;  /**< number of runs */
+    double    mean;         /**< mean of \c samples */
+    double    stddev;       /**< standard deviation of \c samples */
+    double    minimum;      /**< lowest of \c samples */
+    double    maximum;      /**< highest of \c samples */
+    double    baseline;     /**< mean in \c --compare file (0 = none) */
+    bool      printed;      /**< statistics have been printed */
+} bench_result_t;
+
+/** \brief  Results of all benchmark cases, in the order they were reported */
+static bench_result_t *results;
+
+/** \brief  Number of elements in \c results */
+static size_t num_results;
+
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time in nanoseconds
+ */
+uint64_t bench_time_ns(void)
+{
+#ifdef WINDOWS_COMPILE
+    LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/** \brief  Seed pseudo random number generator
+ *
+ * \param[in]   seed    seed (0 is replaced with a non-zero value)
+ */
+void bench_random_seed(uint32_t seed)
+{
+    random_state = seed != 0 ? seed : 0x2545f491u;
+}
+
+/** \brief  Get pseudo random number
+ *
+ * Simple xorshift generator, so benchmarks get the same input on every run.
+ *
+ * \return  pseudo random number
+ */
+uint32_t bench_random(void)
+{
+    uint32_t x = random_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_state = x;
+    return x;
+}
+
+/** \brief  Get number of iterations to run per benchmark
+ *
+ * \return  iterations (set with \c --iterations)
+ */
+uint64_t bench_iterations(void)
+{
+    return opt_iterations > 0 ? (uint64_t)opt_iterations : 1u;
+}
+
+/** \brief  Get results of benchmark case, adding it if needed
+ *
+ * \param[in]   name    name of benchmark case
+ *
+ * \return  results of case
+ */
+static bench_result_t *result_get(const char *name)
+{
+    bench_result_t *result;
+
+    for (size_t i = 0; i < num_results; i++) {
+        if (strcmp(results[i].name, name) == 0) {
+            return &(results[i]);
+        }
+    }
+    results = lib_realloc(results, (num_results + 1u) * sizeof *results);
+    result  = &(results[num_results++]);
+    result->name        = lib_strdup(name);
+    result->ops         = 0;
+    result->bytes       = 0;
+    result->target      = 0.0;
+    result->dropped     = 0;
+    result->samples     = lib_malloc((size_t)opt_repeat * sizeof *result->samples);
+    result->num_samples = 0;
+    result->baseline    = 0.0;
+    result->printed     = false;
+    return result;
+}
+
+/** \brief  Record result of a run of a benchmark case
+ *
+ * The results are printed once all runs of the benchmark are done.
+ *
+ * \param[in]   name        name of benchmark (case)
+ * \param[in]   ops         number of operations performed
+ * \param[in]   elapsed_ns  time taken in nanoseconds
+ */
+void bench_report(const char *name, uint64_t ops, uint64_t elapsed_ns)
+{
+    bench_result_t *result = result_get(name);
+
+    if (result->num_samples < opt_repeat) {
+        result->samples[result->num_samples++] =
+            ops > 0 ? (double)elapsed_ns / (double)ops : 0.0;
+    }
+    result->ops = ops;
+
+    if (verbose) {
+        printf("%-40s %12"PRIu64" ops %10.2f ns/op\n",
+               name, ops, ops > 0 ? (double)elapsed_ns / (double)ops : 0.0);
+    }
+}
+
+/** \brief  Record number of bytes processed by a run of a benchmark case
+ *
+ * For benchmarks that process input data, like parsers: the throughput in
+ * operations and megabytes per second is printed with the results. Call after
+ * \c bench_report() for the run.
+ *
+ * \param[in]   name    name of benchmark (case)
+ * \param[in]   bytes   number of bytes processed
+ */
+void bench_report_bytes(const char *name, uint64_t bytes)
+{
+    result_get(name)->bytes = bytes;
+}
+
+/** \brief  Record result of a run of a benchmark case running at a set rate
+ *
+ * For benchmarks that generate operations at a set rate, where the time taken
+ * is determined by the rate: the rate achieved is reported instead of the time
+ * per operation, together with the target rate and the number of port updates
+ * dropped.
+ *
+ * \param[in]   name        name of benchmark (case)
+ * \param[in]   ops         number of operations performed
+ * \param[in]   elapsed_ns  time taken in nanoseconds
+ * \param[in]   target      target number of operations per second
+ * \param[in]   dropped     number of port updates dropped
+ */
+void bench_report_rate(const char *name,
+                       uint64_t    ops,
+                       uint64_t    elapsed_ns,
+                       double      target,
+                       uint64_t    dropped)
+{
+    bench_result_t *result = result_get(name);
+    double          rate   = elapsed_ns > 0 ? (double)ops * 1e9 / (double)elapsed_ns : 0.0;
+
+    if (result->num_samples < opt_repeat) {
+        result->samples[result->num_samples++] = rate;
+    }
+    result->ops      = ops;
+    result->target   = target;
+    result->dropped += dropped;
+
+    if (verbose) {
+        printf("%-40s %12"PRIu64" ops %10.0f ops/sec\n", name, ops, rate);
+    }
+}
+
+/** \brief  Calculate statistics of benchmark case and print them
+ *
+ * \param[in]   result  results of case
+ */
+static void result_print(bench_result_t *result)
+{
+    double sum = 0.0;
+    double var = 0.0;
+
+    result->minimum = result->samples[0];
+    result->maximum = result->samples[0];
+    for (int i = 0; i < result->num_samples; i++) {
+        sum += result->samples[i];
+        if (result->samples[i] < result->minimum) {
+            result->minimum = result->samples[i];
+        }
+        if (result->samples[i] > result->maximum) {
+            result->maximum = result->samples[i];
+        }
+    }
+    result->mean = sum / result->num_samples;
+    for (int i = 0; i < result->num_samples; i++) {
+        double d = result->samples[i] - result->mean;
+
+        var += d * d;
+    }
+    result->stddev = result->num_samples > 1 ? sqrt(var / (result->num_samples - 1)) : 0.0;
+
+    if (result->target > 0.0) {
+        printf("%-40s %12.0f ops/sec +/- %5.1f%% of %.0f (%.1f%%), %"PRIu64" updates dropped\n",
+               result->name, result->mean,
+               result->mean > 0.0 ? result->stddev * 100.0 / result->mean : 0.0,
+               result->target, result->mean * 100.0 / result->target,
+               result->dropped);
+        return;
+    }
+    printf("%-40s %12"PRIu64" ops %10.2f ns/op +/- %5.1f%% (min %.2f)",
+           result->name, result->ops, result->mean,
+           result->mean > 0.0 ? result->stddev * 100.0 / result->mean : 0.0,
+           result->minimum);
+    if (result->baseline > 0.0) {
+        printf(" %+6.1f%%", (result->mean - result->baseline) * 100.0 / result->baseline);
+    }
+    putchar('\n');
+    if (result->bytes > 0 && result->ops > 0 && result->mean > 0.0) {
+        printf("%-40s %12.0f ops/sec %8.1f MB/sec\n", "",
+               1e9 / result->mean,
+               (double)result->bytes / (double)result->ops * 1e3 / result->mean);
+    }
+}
+
+/** \brief  Read baseline results from CSV file written by \c --output
+ *
+ * \param[in]   path    path to CSV file
+ *
+ * \return  \c false if the file couldn't be opened
+ */
+static bool baseline_read(const char *path)
+{
+    char  line[1024];
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: error: failed to open %s.\n", cmdline_get_prg_name(), path);
+        return false;
+    }
+    /* create results in the order of the file, so they can be matched up
+     * while benchmarking */
+    while (fgets(line, sizeof line, fp) != NULL) {
+        char   *fields[4];
+        size_t  count = 0;
+        char   *s     = line;
+
+        if (line[0] == '#' || strncmp(line, "name,", 5) == 0) {
+            continue;
+        }
+        while (count < ARRAY_LEN(fields)) {
+            fields[count++] = s;
+            s = strchr(s, ',');
+            if (s == NULL) {
+                break;
+            }
+            *s++ = '\0';
+        }
+        if (count == ARRAY_LEN(fields)) {
+            result_get(fields[0])->baseline = strtod(fields[3], NULL);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+/** \brief  Write results to CSV file
+ *
+ * \param[in]   path    path to CSV file
+ *
+ * \return  \c false on error
+ */
+static bool results_write(const char *path)
+{
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: error: failed to open %s.\n", cmdline_get_prg_name(), path);
+        return false;
+    }
+    fprintf(fp, "name,ops,runs,mean_ns,stddev_ns,min_ns,max_ns\n");
+    for (size_t i = 0; i < num_results; i++) {
+        const bench_result_t *result = &(results[i]);
+
+        /* rates aren't costs per operation */
+        if (result->num_samples > 0 && result->target == 0.0) {
+            fprintf(fp, "%s,%"PRIu64",%d,%.3f,%.3f,%.3f,%.3f\n",
+                    result->name, result->ops, result->num_samples,
+                    result->mean, result->stddev, result->minimum, result->maximum);
+        }
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: error: failed to write %s.\n", cmdline_get_prg_name(), path);
+        return false;
+    }
+    return true;
+}
+
+/** \brief  Free results */
+static void results_free(void)
+{
+    for (size_t i = 0; i < num_results; i++) {
+        lib_free(results[i].name);
+        lib_free(results[i].samples);
+    }
+    lib_free(results);
+    results     = NULL;
+    num_results = 0;
+}
+
+/** \brief  Get path of a file in the temporary directory
+ *
+ * Uses \c $TMPDIR or \c $TEMP, falling back to \c /tmp.
+ *
+ * \param[in]   filename    name of file
+ *
+ * \return  path, free with \c lib_free()
+ */
+char *bench_tmp_path(const char *filename)
+{
+    const char *tmpdir;
+
+    tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL) {
+        tmpdir = getenv("TEMP");
+    }
+    return lib_msprintf("%s/%s", tmpdir != NULL ? tmpdir : "/tmp", filename);
+}
+
+/** \brief  Create joystick device with a given number of inputs
+ *
+ * Codes are assigned like the Linux driver does: axes start at 0, buttons at
+ * \c 0x100 (BTN_MISC) and hats at 0. All inputs have a default mapping.
+ *
+ * \param[in]   num_axes    number of axes
+ * \param[in]   num_buttons number of buttons
+ * \param[in]   num_hats    number of hats
+ *
+ * \return  new joystick device, free with \c joy_device_free()
+ */
+joy_device_t *bench_device_new(uint32_t num_axes,
+                               uint32_t num_buttons,
+                               uint32_t num_hats)
+{
+    joy_device_t *joydev = joy_device_new();
+    uint32_t      i;
+
+    joydev->name = lib_msprintf("Bench device (%"PRIu32" axes, %"PRIu32
+                                " buttons, %"PRIu32" hats)",
+                                num_axes, num_buttons, num_hats);
+    joydev->node = lib_strdup("bench");
+    joydev->port = 0;
+
+    joydev->num_axes = num_axes;
+    if (num_axes > 0) {
+        joydev->axes = lib_malloc(num_axes * sizeof *(joydev->axes));
+        for (i = 0; i < num_axes; i++) {
+            joy_axis_t *axis = &(joydev->axes[i]);
+
+            joy_axis_init(axis);
+            axis->code = (uint16_t)i;
+            axis->name = lib_msprintf("ABS_%"PRIu32, i);
+            joy_axis_auto_calibrate(axis);
+        }
+    }
+
+    joydev->num_buttons = num_buttons;
+    if (num_buttons > 0) {
+        joydev->buttons = lib_malloc(num_buttons * sizeof *(joydev->buttons));
+        for (i = 0; i < num_buttons; i++) {
+            joy_button_t *button = &(joydev->buttons[i]);
+
+            joy_button_init(button);
+            button->code = (uint16_t)(0x100u + i);
+            button->name = lib_msprintf("BTN_%"PRIu32, i);
+        }
+    }
+
+    joydev->num_hats = num_hats;
+    if (num_hats > 0) {
+        joydev->hats = lib_malloc(num_hats * sizeof *(joydev->hats));
+        for (i = 0; i < num_hats; i++) {
+            joy_hat_t *hat = &(joydev->hats[i]);
+
+            joy_hat_init(hat);
+            hat->code = (uint16_t)i;
+            hat->name = lib_msprintf("HAT_%"PRIu32, i);
+        }
+    }
+
+    joy_device_set_capabilities(joydev);
+    joy_device_build_index(joydev);
+    return joydev;
+}
+
+
+/*
+ * No-op arch driver, the benchmarks create their own devices
+ */
+
+bool joy_arch_init(void)
+{
+    return true;
+}
+
+void joy_arch_shutdown(void)
+{
+}
+
+int joy_arch_device_list_init(joy_device_t ***devices)
+{
+    *devices = NULL;
+    return 0;
+}
+
+bool joy_arch_device_create_default_mapping(joy_device_t *joydev)
+{
+    (void)joydev;
+    return true;
+}
+
+
+/** \brief  Check if benchmark was requested on the command line
+ *
+ * \param[in]   name    benchmark name
+ * \param[in]   args    non-option arguments
+ * \param[in]   nargs   number of elements in \a args
+ *
+ * \return  \c true if \a name is in \a args or \a args is empty
+ */
+static bool bench_selected(const char *name, char **args, int nargs)
+{
+    if (nargs <= 0) {
+        return true;
+    }
+    for (int i = 0; i < nargs; i++) {
+        if (strcmp(args[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+int main(int argc, char **argv)
+{
+    char **args  = NULL;
+    int    nargs;
+    int    status = EXIT_SUCCESS;
+
+    cmdline_init("vice-joydriver-bench", "0.1");
+    if (!cmdline_add_options(options)) {
+        cmdline_free();
+        return EXIT_FAILURE;
+    }
+    nargs = cmdline_parse(argc, argv, &args);
+    if (nargs == CMDLINE_ERROR) {
+        status = EXIT_FAILURE;
+        goto cleanup;
+    } else if (nargs == CMDLINE_HELP || nargs == CMDLINE_VERSION) {
+        goto cleanup;
+    }
+
+    if (opt_repeat < 1) {
+        opt_repeat = 1;
+    }
+    if (opt_compare_file != NULL && !baseline_read(opt_compare_file)) {
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    joy_init();
+    joymap_module_init();
+
+    for (size_t l = 0; bench_lists[l] != NULL; l++) {
+        for (const bench_t *bench = bench_lists[l]; bench->name != NULL; bench++) {
+            if (opt_list) {
+                printf("%-20s %s\n", bench->name, bench->desc);
+            } else if (bench_selected(bench->name, args, nargs)) {
+                printf("%s: %s\n", bench->name, bench->desc);
+                for (int run = 0; run < opt_repeat; run++) {
+                    bench->run();
+                }
+                for (size_t i = 0; i < num_results; i++) {
+                    if (results[i].num_samples > 0 && !results[i].printed) {
+                        result_print(&(results[i]));
+                        results[i].printed = true;
+                    }
+                }
+                putchar('\n');
+            }
+        }
+    }
+
+    if (opt_output_file != NULL && !opt_list && !results_write(opt_output_file)) {
+        status = EXIT_FAILURE;
+    }
+
+    joymap_module_shutdown();
+    joy_shutdown();
+cleanup:
+    results_free();
+    cmdline_free();
+    lib_free(opt_output_file);
+    lib_free(opt_compare_file);
+    return status;
+}
@@ -0,0 +1,75 @@
+/** \file   bench.h
+ * \brief   Benchmark helpers - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "joyapi-types.h"
+
+/** \brief  Benchmark registration object */
+typedef struct bench_s {
+    const char *name;   /**< name used to select the benchmark */
+    const char *desc;   /**< short description */
+    void      (*run)(void);     /**< benchmark function */
+} bench_t;
+
+/** \brief  Event patterns of synthetic devices */
+typedef enum synth_pattern_e {
+    SYNTH_STICK_SWEEP,  /**< axes sweeping through all directions */
+    SYNTH_BUTTON_MASH,  /**< buttons pressed and released in turn */
+    SYNTH_HAT_SPIN,     /**< hats spinning clockwise */
+    SYNTH_MIXED         /**< random mix of the above */
+} synth_pattern_t;
+
+/** \brief  Inputs and events of a synthetic device */
+typedef struct synth_spec_s {
+    uint32_t        num_axes;           /**< number of axes */
+    uint32_t        num_buttons;        /**< number of buttons */
+    uint32_t        num_hats;           /**< number of hats */
+    synth_pattern_t pattern;            /**< events to generate */
+    uint32_t        events_per_poll;    /**< maximum events per poll */
+    uint32_t        events_per_frame;   /**< events per submitted frame */
+    uint64_t        rate;               /**< events per second (0 = as many
+                                             as \c events_per_poll) */
+} synth_spec_t;
+
+/** \brief  Terminator for benchmark lists */
+#define BENCH_LIST_END { .name = NULL, .desc = NULL, .run = NULL }
+
+/* benchmark lists provided by the bench-*.c modules */
+extern const bench_t bench_events_list[];
+extern const bench_t bench_lookup_list[];
+extern const bench_t bench_synth_list[];
+extern const bench_t bench_vjm_list[];
+
+uint64_t      bench_time_ns(void);
+uint32_t      bench_random(void);
+void          bench_random_seed(uint32_t seed);
+uint64_t      bench_iterations(void);
+void          bench_report(const char *name, uint64_t ops, uint64_t elapsed_ns);
+void          bench_report_bytes(const char *name, uint64_t bytes);
+void          bench_report_rate (const char *name, uint64_t ops, uint64_t elapsed_ns,
+                                 double target, uint64_t dropped);
+char         *bench_tmp_path(const char *filename);
+
+joy_device_t *bench_device_new(uint32_t num_axes,
+                               uint32_t num_buttons,
+                               uint32_t num_hats);
+
+void          bench_synth_register  (void);
+joy_device_t *bench_synth_device_new(const synth_spec_t *spec, int port);
+uint64_t      bench_synth_generated (const joy_device_t *joydev);
+
+/** \brief  Keep the compiler from optimizing away a value
+ *
+ * \param[in]   p   pointer to value
+ */
+#define bench_use(p) __asm__ volatile ("" : : "g" (p) : "memory")
+
+#endif
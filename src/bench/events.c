@@ -0,0 +1,316 @@
+/** \file   events.c
+ * \brief   Benchmarks for the event handlers, UI action lookup and joymap loading
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * All benchmarks work on fixed inputs generated with the seeded pseudo random
+ * number generator, so results of different runs and commits can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "joyapi.h"
+#include "joymap.h"
+#include "lib.h"
+#include "uiactions.h"
+
+#include "bench.h"
+
+
+/** \brief  Number of values in the precomputed input sequences
+ *
+ * Must be a power of two.
+ */
+#define VALUES_COUNT    4096u
+
+/** \brief  Number of events after which the port queue is drained */
+#define DRAIN_INTERVAL  256u
+
+/** \brief  Number of iterations per joymap load */
+#define JOYMAP_ITERATIONS_PER_LOAD  1000u
+
+
+/** \brief  Joymap used for the load benchmark */
+static const char joymap_text[] =
+    "# VICE joymap for the load benchmark\n"
+    "\n"
+    "vjm-version     2.0\n"
+    "\n"
+    "device-vendor   0x046d\n"
+    "device-product  0xc21f\n"
+    "device-version  0x0305\n"
+    "device-name     \"Logitech F710 XInput\"\n"
+    "\n"
+    "# input mappings, host <-> guest\n"
+    "map pin  1  axis    \"ABS_Y\"     negative\n"
+    "map pin  2  axis    \"ABS_Y\"     positive\n"
+    "map pin  4  axis    \"ABS_X\"     negative\n"
+    "map pin  8  axis    \"ABS_X\"     positive\n"
+    "map pin 16  button  \"BTN_SOUTH\"\n"
+    "map pin 32  button  \"BTN_NORTH\"\n"
+    "\n"
+    "map key 1   2   %01100001   button  \"BTN_WEST\"\n"
+    "\n"
+    "map action machine-power-cycle  button  \"BTN_EAST\"\n"
+    "map action \"drive-attach-8:0\"   axis    \"ABS_HAT0X\" positive\n"
+    "\n"
+    "calibrate axis \"ABS_X\" negative threshold -10000\n"
+    "calibrate axis \"ABS_X\" positive threshold  10000\n";
+
+
+/** \brief  Drain the port queue */
+static void drain_ports(void)
+{
+    joy_port_update_t updates[DRAIN_INTERVAL];
+
+    while (joy_queue_drain(joy_port_queue(), updates, DRAIN_INTERVAL) == DRAIN_INTERVAL) {
+        /* NOP */
+    }
+}
+
+/** \brief  Create device with mapped axes, buttons and hats
+ *
+ * \param[in]   num_axes    number of axes
+ * \param[in]   num_buttons number of buttons
+ * \param[in]   num_hats    number of hats
+ *
+ * \return  new device, free with \c joy_device_free()
+ */
+static joy_device_t *mapped_device_new(uint32_t num_axes,
+                                       uint32_t num_buttons,
+                                       uint32_t num_hats)
+{
+    synth_spec_t spec = {
+        .num_axes    = num_axes,
+        .num_buttons = num_buttons,
+        .num_hats    = num_hats,
+        .pattern     = SYNTH_MIXED
+    };
+
+    /* the synthetic driver frees the device data */
+    bench_synth_register();
+    return bench_synth_device_new(&spec, 0);
+}
+
+
+/** \brief  Benchmark conversion of raw axis values */
+static void bench_axis_value(void)
+{
+    joy_device_t *joydev;
+    joy_axis_t   *axis;
+    int32_t       values[VALUES_COUNT];
+    uint64_t      iters = bench_iterations();
+    uint64_t      start;
+
+    joydev = bench_device_new(1, 0, 0);
+    axis   = &(joydev->axes[0]);
+    axis->minimum = INT16_MIN;
+    axis->maximum = INT16_MAX;
+    joy_axis_auto_calibrate(axis);
+
+    bench_random_seed(1);
+    for (uint32_t i = 0; i < VALUES_COUNT; i++) {
+        values[i] = (int32_t)(bench_random() % 65536u) + INT16_MIN;
+    }
+
+    start = bench_time_ns();
+    for (uint64_t i = 0; i < iters; i++) {
+        joystick_axis_value_t value;
+
+        value = joy_axis_value_from_hwdata(axis, values[i & (VALUES_COUNT - 1u)]);
+        bench_use(value);
+    }
+    bench_report("axis-value-from-hwdata", iters, bench_time_ns() - start);
+
+    joy_device_free(joydev);
+}
+
+/** \brief  Benchmark the axis, button and hat event handlers
+ *
+ * Random input values are passed to mapped inputs, the port queue is drained
+ * every \c DRAIN_INTERVAL events like an emulation thread would.
+ */
+static void bench_input_events(void)
+{
+    static const int32_t hat_values[9] = {
+        JOYSTICK_DIRECTION_NONE,
+        JOYSTICK_DIRECTION_UP,
+        JOYSTICK_DIRECTION_UP    | JOYSTICK_DIRECTION_RIGHT,
+        JOYSTICK_DIRECTION_RIGHT,
+        JOYSTICK_DIRECTION_RIGHT | JOYSTICK_DIRECTION_DOWN,
+        JOYSTICK_DIRECTION_DOWN,
+        JOYSTICK_DIRECTION_DOWN  | JOYSTICK_DIRECTION_LEFT,
+        JOYSTICK_DIRECTION_LEFT,
+        JOYSTICK_DIRECTION_LEFT  | JOYSTICK_DIRECTION_UP
+    };
+    joy_device_t *joydev;
+    uint32_t      inputs[VALUES_COUNT];
+    int32_t       values[VALUES_COUNT];
+    uint64_t      iters = bench_iterations();
+    uint64_t      start;
+
+    joydev = mapped_device_new(2, 4, 1);
+
+    bench_random_seed(2);
+    for (uint32_t i = 0; i < VALUES_COUNT; i++) {
+        inputs[i] = bench_random() % 2u;
+        values[i] = (int32_t)(bench_random() % 3u) - 1;
+    }
+    drain_ports();
+    start = bench_time_ns();
+    for (uint64_t i = 0; i < iters; i++) {
+        uint32_t n = (uint32_t)i & (VALUES_COUNT - 1u);
+
+        joy_axis_event(joydev, &(joydev->axes[inputs[n]]),
+                       (joystick_axis_value_t)values[n]);
+        if (n % DRAIN_INTERVAL == DRAIN_INTERVAL - 1u) {
+            drain_ports();
+        }
+    }
+    bench_report("axis-event", iters, bench_time_ns() - start);
+
+    for (uint32_t i = 0; i < VALUES_COUNT; i++) {
+        inputs[i] = bench_random() % 4u;
+        values[i] = (int32_t)(bench_random() % 2u);
+    }
+    drain_ports();
+    start = bench_time_ns();
+    for (uint64_t i = 0; i < iters; i++) {
+        uint32_t n = (uint32_t)i & (VALUES_COUNT - 1u);
+
+        joy_button_event(joydev, &(joydev->buttons[inputs[n]]), values[n]);
+        if (n % DRAIN_INTERVAL == DRAIN_INTERVAL - 1u) {
+            drain_ports();
+        }
+    }
+    bench_report("button-event", iters, bench_time_ns() - start);
+
+    for (uint32_t i = 0; i < VALUES_COUNT; i++) {
+        values[i] = hat_values[bench_random() % ARRAY_LEN(hat_values)];
+    }
+    drain_ports();
+    start = bench_time_ns();
+    for (uint64_t i = 0; i < iters; i++) {
+        uint32_t n = (uint32_t)i & (VALUES_COUNT - 1u);
+
+        joy_hat_event(joydev, &(joydev->hats[0]), values[n]);
+        if (n % DRAIN_INTERVAL == DRAIN_INTERVAL - 1u) {
+            drain_ports();
+        }
+    }
+    bench_report("hat-event", iters, bench_time_ns() - start);
+
+    drain_ports();
+    joy_device_free(joydev);
+}
+
+/** \brief  Benchmark looking up UI actions by name */
+static void bench_ui_action_id(void)
+{
+    const char *all[ACTION_ID_COUNT];
+    const char *names[VALUES_COUNT];
+    uint32_t    count = 0;
+    uint64_t    iters = bench_iterations();
+    uint64_t    start;
+
+    for (int id = ACTION_NONE + 1; id < ACTION_ID_COUNT; id++) {
+        const char *name = ui_action_get_name(id);
+
+        if (name != NULL) {
+            all[count++] = name;
+        }
+    }
+    bench_random_seed(3);
+    for (uint32_t i = 0; i < VALUES_COUNT; i++) {
+        names[i] = all[bench_random() % count];
+    }
+
+    start = bench_time_ns();
+    for (uint64_t i = 0; i < iters; i++) {
+        int id = ui_action_get_id(names[i & (VALUES_COUNT - 1u)]);
+
+        bench_use(id);
+    }
+    bench_report("ui-action-get-id", iters, bench_time_ns() - start);
+}
+
+/** \brief  Benchmark loading a joymap file
+ *
+ * The joymap is written to a temporary file first. Loading is much slower than
+ * the other operations, so one load is done per \c JOYMAP_ITERATIONS_PER_LOAD
+ * iterations.
+ */
+static void bench_joymap_load(void)
+{
+    static const char *axis_names[]   = { "ABS_X", "ABS_Y", "ABS_HAT0X" };
+    static const char *button_names[] = { "BTN_SOUTH", "BTN_EAST", "BTN_NORTH", "BTN_WEST" };
+
+    joy_device_t *joydev;
+    char         *path;
+    FILE         *fp;
+    uint64_t      loads = bench_iterations() / JOYMAP_ITERATIONS_PER_LOAD;
+    uint64_t      start;
+
+    path = bench_tmp_path("vice-joydriver-bench.vjm");
+    fp   = fopen(path, "w");
+    if (fp == NULL || fputs(joymap_text, fp) == EOF || fclose(fp) != 0) {
+        fprintf(stderr, "failed to write %s, skipping.\n", path);
+        lib_free(path);
+        return;
+    }
+
+    joydev = mapped_device_new(ARRAY_LEN(axis_names), ARRAY_LEN(button_names), 0);
+    for (uint32_t a = 0; a < joydev->num_axes; a++) {
+        lib_free(joydev->axes[a].name);
+        joydev->axes[a].name = lib_strdup(axis_names[a]);
+    }
+    for (uint32_t b = 0; b < joydev->num_buttons; b++) {
+        lib_free(joydev->buttons[b].name);
+        joydev->buttons[b].name = lib_strdup(button_names[b]);
+    }
+    joy_device_build_index(joydev);
+
+    if (loads == 0) {
+        loads = 1;
+    }
+    start = bench_time_ns();
+    for (uint64_t i = 0; i < loads; i++) {
+        joymap_t *joymap = joymap_load(joydev, path);
+
+        if (joymap == NULL) {
+            fprintf(stderr, "failed to load %s.\n", path);
+            break;
+        }
+        joymap_free(joymap);
+    }
+    bench_report("joymap-load", loads, bench_time_ns() - start);
+
+    joy_device_free(joydev);
+    remove(path);
+    lib_free(path);
+}
+
+
+/** \brief  List of event handler, UI action and joymap benchmarks */
+const bench_t bench_events_list[] = {
+    {   .name = "axis-value",
+        .desc = "joy_axis_value_from_hwdata() for random raw values",
+        .run  = bench_axis_value
+    },
+    {   .name = "input-events",
+        .desc = "joy_axis_event(), joy_button_event() and joy_hat_event() on mapped inputs",
+        .run  = bench_input_events
+    },
+    {   .name = "ui-action-id",
+        .desc = "ui_action_get_id() for random action names",
+        .run  = bench_ui_action_id
+    },
+    {   .name = "joymap-load",
+        .desc = "joymap_load() of a small joymap file",
+        .run  = bench_joymap_load
+    },
+    BENCH_LIST_END
+};
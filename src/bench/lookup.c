@@ -0,0 +1,246 @@
+/** \file   lookup.c
+ * \brief   Benchmarks for looking up device inputs by event code
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "joyapi.h"
+#include "lib.h"
+
+#include "bench.h"
+
+
+/** \brief  Number of codes in the precomputed input sequence */
+#define CODES_COUNT 4096u
+
+
+/** \brief  Input types to benchmark */
+typedef enum {
+    LOOKUP_AXIS,
+    LOOKUP_BUTTON,
+    LOOKUP_HAT
+} lookup_type_t;
+
+
+/** \brief  Time lookups of random valid codes
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   type    input type to look up
+ * \param[in]   codes   sequence of codes to look up
+ *
+ * \return  time taken in nanoseconds
+ */
+static uint64_t time_lookups(joy_device_t   *joydev,
+                             lookup_type_t   type,
+                             const uint16_t *codes)
+{
+    uint64_t iters = bench_iterations();
+    uint64_t start;
+    uint64_t i;
+    void    *input;
+
+    start = bench_time_ns();
+    for (i = 0; i < iters; i++) {
+        uint16_t code = codes[i & (CODES_COUNT - 1u)];
+
+        switch (type) {
+            case LOOKUP_AXIS:
+                input = joy_axis_from_code(joydev, code);
+                break;
+            case LOOKUP_BUTTON:
+                input = joy_button_from_code(joydev, code);
+                break;
+            default:
+                input = joy_hat_from_code(joydev, code);
+                break;
+        }
+        bench_use(input);
+    }
+    return bench_time_ns() - start;
+}
+
+/** \brief  Run lookup benchmark for a device with \a count inputs
+ *
+ * Time lookups once with the device's code lookup tables and once with the
+ * tables disabled, which makes the lookup functions fall back to scanning.
+ *
+ * \param[in]   type    input type to look up
+ * \param[in]   count   number of inputs of \a type on the device
+ */
+static void run_lookup(lookup_type_t type, uint32_t count)
+{
+    static const char *type_names[] = { "axis", "button", "hat" };
+
+    joy_device_t     *joydev;
+    joy_code_index_t *index;
+    joy_code_index_t  saved;
+    uint16_t          codes[CODES_COUNT];
+    uint16_t          base;
+    char              name[64];
+    uint64_t          elapsed;
+
+    switch (type) {
+        case LOOKUP_AXIS:
+            joydev = bench_device_new(count, 0, 0);
+            index  = &joydev->axis_index;
+            base   = 0;
+            break;
+        case LOOKUP_BUTTON:
+            joydev = bench_device_new(0, count, 0);
+            index  = &joydev->button_index;
+            base   = 0x100;
+            break;
+        default:
+            joydev = bench_device_new(0, 0, count);
+            index  = &joydev->hat_index;
+            base   = 0;
+            break;
+    }
+
+    bench_random_seed(count);
+    for (uint32_t i = 0; i < CODES_COUNT; i++) {
+        codes[i] = (uint16_t)(base + bench_random() % count);
+    }
+
+    elapsed = time_lookups(joydev, type, codes);
+    snprintf(name, sizeof name, "%s-%"PRIu32"-indexed", type_names[type], count);
+    bench_report(name, bench_iterations(), elapsed);
+
+    /* temporarily remove table to measure the scan */
+    saved        = *index;
+    index->table = NULL;
+    elapsed = time_lookups(joydev, type, codes);
+    *index  = saved;
+    snprintf(name, sizeof name, "%s-%"PRIu32"-scan", type_names[type], count);
+    bench_report(name, bench_iterations(), elapsed);
+
+    joy_device_free(joydev);
+}
+
+/** \brief  Benchmark axis, button and hat lookup by code */
+static void bench_from_code(void)
+{
+    static const uint32_t counts[] = { 10, 100, 500 };
+
+    for (size_t c = 0; c < ARRAY_LEN(counts); c++) {
+        run_lookup(LOOKUP_AXIS,   counts[c]);
+        run_lookup(LOOKUP_BUTTON, counts[c]);
+        run_lookup(LOOKUP_HAT,    counts[c]);
+    }
+}
+
+
+/** \brief  Time lookups of inputs by name
+ *
+ * \param[in]   type    input type to look up
+ * \param[in]   count   number of inputs of \a type on the device
+ */
+static void run_name_lookup(lookup_type_t type, uint32_t count)
+{
+    static const char *type_names[] = { "axis", "button", "hat" };
+
+    joy_device_t     *joydev;
+    joy_name_index_t *index;
+    joy_name_index_t  saved;
+    const char       *names[CODES_COUNT];
+    char              name[64];
+    uint64_t          iters = bench_iterations();
+    uint64_t          elapsed;
+    uint64_t          start;
+    void             *input;
+
+    switch (type) {
+        case LOOKUP_AXIS:
+            joydev = bench_device_new(count, 0, 0);
+            index  = &joydev->axis_names;
+            break;
+        case LOOKUP_BUTTON:
+            joydev = bench_device_new(0, count, 0);
+            index  = &joydev->button_names;
+            break;
+        default:
+            joydev = bench_device_new(0, 0, count);
+            index  = &joydev->hat_names;
+            break;
+    }
+
+    bench_random_seed(count);
+    for (uint32_t i = 0; i < CODES_COUNT; i++) {
+        uint32_t n = bench_random() % count;
+
+        switch (type) {
+            case LOOKUP_AXIS:
+                names[i] = joydev->axes[n].name;
+                break;
+            case LOOKUP_BUTTON:
+                names[i] = joydev->buttons[n].name;
+                break;
+            default:
+                names[i] = joydev->hats[n].name;
+                break;
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            /* temporarily remove table to measure the scan */
+            saved        = *index;
+            index->slots = NULL;
+        }
+        start = bench_time_ns();
+        for (uint64_t i = 0; i < iters; i++) {
+            const char *s = names[i & (CODES_COUNT - 1u)];
+
+            switch (type) {
+                case LOOKUP_AXIS:
+                    input = joy_axis_from_name(joydev, s);
+                    break;
+                case LOOKUP_BUTTON:
+                    input = joy_button_from_name(joydev, s);
+                    break;
+                default:
+                    input = joy_hat_from_name(joydev, s);
+                    break;
+            }
+            bench_use(input);
+        }
+        elapsed = bench_time_ns() - start;
+        snprintf(name, sizeof name, "%s-%"PRIu32"-%s",
+                 type_names[type], count, pass == 0 ? "hashed" : "scan");
+        bench_report(name, iters, elapsed);
+    }
+    *index = saved;
+
+    joy_device_free(joydev);
+}
+
+/** \brief  Benchmark axis, button and hat lookup by name */
+static void bench_from_name(void)
+{
+    static const uint32_t counts[] = { 10, 100, 500 };
+
+    for (size_t c = 0; c < ARRAY_LEN(counts); c++) {
+        run_name_lookup(LOOKUP_AXIS,   counts[c]);
+        run_name_lookup(LOOKUP_BUTTON, counts[c]);
+        run_name_lookup(LOOKUP_HAT,    counts[c]);
+    }
+}
+
+
+/** \brief  Input lookup benchmarks */
+const bench_t bench_lookup_list[] = {
+    {   .name = "from-code",
+        .desc = "joy_*_from_code() per-event cost for 10, 100 and 500 inputs",
+        .run  = bench_from_code
+    },
+    {   .name = "from-name",
+        .desc = "joy_*_from_name() cost for 10, 100 and 500 inputs",
+        .run  = bench_from_name
+    },
+    BENCH_LIST_END
+};
@@ -0,0 +1,534 @@
+/** \file   synth.c
+ * \brief   Synthetic load generator driver and scaling benchmarks
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Driver whose devices generate events instead of reading them from the host:
+ * stick sweeps, button mashing, hat spins or a random mix of those, in frames
+ * of a given size and optionally limited to a rate. The devices are polled
+ * with \c joy_poll() and submit their events with the batch API, like the
+ * Linux driver, so the benchmarks cover polling, dispatch through the
+ * compiled mappings and aggregation of the emulated ports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "joyapi.h"
+#include "lib.h"
+
+#include "bench.h"
+
+
+/** \brief  Number of port updates drained at once */
+#define DRAIN_MAX   256u
+
+/** \brief  Synthetic device data */
+typedef struct synth_hwdata_s {
+    synth_spec_t spec;      /**< what to generate */
+    uint32_t     step;      /**< position in pattern */
+    uint64_t     generated; /**< number of events generated */
+    uint64_t     start;     /**< time of first poll in nanoseconds */
+    bool         opened;    /**< device is opened for polling */
+} synth_hwdata_t;
+
+
+/** \brief  Axis positions of a stick sweeping in a circle
+ *
+ * Odd axes lag two steps behind even axes, so each pair of axes moves through
+ * all eight directions.
+ */
+static const joystick_axis_value_t sweep[8] = {
+    JOY_AXIS_NEGATIVE, JOY_AXIS_NEGATIVE, JOY_AXIS_CENTERED, JOY_AXIS_POSITIVE,
+    JOY_AXIS_POSITIVE, JOY_AXIS_POSITIVE, JOY_AXIS_CENTERED, JOY_AXIS_NEGATIVE
+};
+
+/** \brief  Hat directions of a hat spinning clockwise */
+static const int32_t spin[8] = {
+    JOYSTICK_DIRECTION_UP,
+    JOYSTICK_DIRECTION_UP    | JOYSTICK_DIRECTION_RIGHT,
+    JOYSTICK_DIRECTION_RIGHT,
+    JOYSTICK_DIRECTION_RIGHT | JOYSTICK_DIRECTION_DOWN,
+    JOYSTICK_DIRECTION_DOWN,
+    JOYSTICK_DIRECTION_DOWN  | JOYSTICK_DIRECTION_LEFT,
+    JOYSTICK_DIRECTION_LEFT,
+    JOYSTICK_DIRECTION_LEFT  | JOYSTICK_DIRECTION_UP
+};
+
+/** \brief  Fire buttons the synthetic buttons are mapped to */
+static const int fire_pins[3] = {
+    JOYSTICK_BUTTON_FIRE1, JOYSTICK_BUTTON_FIRE2, JOYSTICK_BUTTON_FIRE3
+};
+
+
+/** \brief  Add next event of a pattern to batch
+ *
+ * \param[in]   joydev  synthetic device
+ * \param[in]   hwdata  synthetic device data
+ * \param[in]   pattern pattern (not \c SYNTH_MIXED)
+ * \param[in]   batch   event batch
+ *
+ * \return  \c false if the device has no inputs for \a pattern
+ */
+static bool synth_event(joy_device_t      *joydev,
+                        synth_hwdata_t    *hwdata,
+                        synth_pattern_t    pattern,
+                        joy_event_batch_t *batch)
+{
+    uint32_t step = hwdata->step;
+    uint32_t n;
+
+    switch (pattern) {
+        case SYNTH_STICK_SWEEP:
+            if (joydev->num_axes == 0) {
+                return false;
+            }
+            n = step % joydev->num_axes;
+            joy_event_batch_axis(batch, &(joydev->axes[n]),
+                                 sweep[(step / joydev->num_axes + (n & 1u) * 6u) & 7u],
+                                 0);
+            break;
+        case SYNTH_BUTTON_MASH:
+            if (joydev->num_buttons == 0) {
+                return false;
+            }
+            n = step % joydev->num_buttons;
+            joy_event_batch_button(batch, &(joydev->buttons[n]),
+                                   (int32_t)((step / joydev->num_buttons) & 1u), 0);
+            break;
+        case SYNTH_HAT_SPIN:
+            if (joydev->num_hats == 0) {
+                return false;
+            }
+            n = step % joydev->num_hats;
+            joy_event_batch_hat(batch, &(joydev->hats[n]),
+                                spin[(step / joydev->num_hats) & 7u], 0);
+            break;
+        default:
+            return false;
+    }
+    hwdata->step++;
+    return true;
+}
+
+/** \brief  Add next event of the device's pattern to batch
+ *
+ * The mixed pattern picks one of the other patterns at random, weighted by
+ * the number of inputs of each type.
+ *
+ * \param[in]   joydev  synthetic device
+ * \param[in]   batch   event batch
+ *
+ * \return  \c false if the device has no inputs for its pattern
+ */
+static bool synth_next(joy_device_t *joydev, joy_event_batch_t *batch)
+{
+    synth_hwdata_t *hwdata  = joydev->hwdata;
+    synth_pattern_t pattern = hwdata->spec.pattern;
+
+    if (pattern == SYNTH_MIXED) {
+        uint32_t total = joydev->num_axes + joydev->num_buttons + joydev->num_hats;
+        uint32_t r;
+
+        if (total == 0) {
+            return false;
+        }
+        r = bench_random() % total;
+        if (r < joydev->num_axes) {
+            pattern = SYNTH_STICK_SWEEP;
+        } else if (r < joydev->num_axes + joydev->num_buttons) {
+            pattern = SYNTH_BUTTON_MASH;
+        } else {
+            pattern = SYNTH_HAT_SPIN;
+        }
+    }
+    return synth_event(joydev, hwdata, pattern, batch);
+}
+
+
+/** \brief  Open synthetic device
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c false if \a joydev isn't a synthetic device
+ */
+static bool synth_open(joy_device_t *joydev)
+{
+    synth_hwdata_t *hwdata = joydev->hwdata;
+
+    if (hwdata == NULL) {
+        return false;
+    }
+    hwdata->opened    = true;
+    hwdata->generated = 0;
+    hwdata->start     = 0;
+    return true;
+}
+
+/** \brief  Close synthetic device
+ *
+ * \param[in]   joydev  joystick device
+ */
+static void synth_close(joy_device_t *joydev)
+{
+    synth_hwdata_t *hwdata = joydev->hwdata;
+
+    if (hwdata != NULL) {
+        hwdata->opened = false;
+    }
+}
+
+/** \brief  Generate events of synthetic device
+ *
+ * Generates \c events_per_poll events, or the number of events due at the
+ * device's rate if that's lower, submitting a frame every
+ * \c events_per_frame events.
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c false if the device isn't opened
+ */
+static bool synth_poll(joy_device_t *joydev)
+{
+    synth_hwdata_t    *hwdata = joydev->hwdata;
+    joy_event_batch_t  batch;
+    uint64_t           count;
+    uint32_t           frame = 0;
+
+    if (hwdata == NULL || !hwdata->opened) {
+        return false;
+    }
+
+    count = hwdata->spec.events_per_poll;
+    if (hwdata->spec.rate > 0) {
+        uint64_t now = bench_time_ns();
+        uint64_t due;
+
+        if (hwdata->start == 0) {
+            hwdata->start = now;
+        }
+        due = (uint64_t)((double)(now - hwdata->start) *
+                         (double)hwdata->spec.rate / 1e9) - hwdata->generated;
+        if (due < count) {
+            count = due;
+        }
+    }
+
+    joy_event_batch_init(&batch, joydev, true);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!synth_next(joydev, &batch)) {
+            break;
+        }
+        hwdata->generated++;
+        if (++frame == hwdata->spec.events_per_frame) {
+            joy_event_batch_flush(&batch);
+            frame = 0;
+        }
+    }
+    if (batch.count > 0) {
+        joy_event_batch_flush(&batch);
+    }
+    return true;
+}
+
+/** \brief  Free synthetic device data
+ *
+ * \param[in]   hwdata  synthetic device data
+ */
+static void synth_hwdata_free(void *hwdata)
+{
+    lib_free(hwdata);
+}
+
+
+/** \brief  Register the synthetic driver
+ *
+ * Replaces the no-op arch driver, devices without synthetic device data
+ * cannot be opened.
+ */
+void bench_synth_register(void)
+{
+    joy_driver_t driver = {
+        .open        = synth_open,
+        .close       = synth_close,
+        .poll        = synth_poll,
+        .hwdata_free = synth_hwdata_free
+    };
+
+    joy_driver_register(&driver);
+}
+
+/** \brief  Create synthetic device
+ *
+ * All inputs are mapped: even and odd axes to left/right and up/down, buttons
+ * to the three fire buttons in turn and hats to the four directions.
+ *
+ * \param[in]   spec    inputs and events to generate
+ * \param[in]   port    emulated port of device
+ *
+ * \return  new device, free with \c joy_device_free()
+ */
+joy_device_t *bench_synth_device_new(const synth_spec_t *spec, int port)
+{
+    joy_device_t   *joydev;
+    synth_hwdata_t *hwdata;
+
+    joydev = bench_device_new(spec->num_axes, spec->num_buttons, spec->num_hats);
+    joydev->port = port;
+
+    for (uint32_t a = 0; a < joydev->num_axes; a++) {
+        joy_axis_t *axis = &(joydev->axes[a]);
+
+        axis->mapping.negative.action     = JOY_ACTION_JOYSTICK;
+        axis->mapping.negative.target.pin = (a & 1u) ? JOYSTICK_DIRECTION_UP
+                                                     : JOYSTICK_DIRECTION_LEFT;
+        axis->mapping.positive.action     = JOY_ACTION_JOYSTICK;
+        axis->mapping.positive.target.pin = (a & 1u) ? JOYSTICK_DIRECTION_DOWN
+                                                     : JOYSTICK_DIRECTION_RIGHT;
+    }
+    for (uint32_t b = 0; b < joydev->num_buttons; b++) {
+        joy_button_t *button = &(joydev->buttons[b]);
+
+        button->mapping.action     = JOY_ACTION_JOYSTICK;
+        button->mapping.target.pin = fire_pins[b % ARRAY_LEN(fire_pins)];
+    }
+    for (uint32_t h = 0; h < joydev->num_hats; h++) {
+        joy_hat_t *hat = &(joydev->hats[h]);
+
+        hat->mapping.up.action        = JOY_ACTION_JOYSTICK;
+        hat->mapping.up.target.pin    = JOYSTICK_DIRECTION_UP;
+        hat->mapping.down.action      = JOY_ACTION_JOYSTICK;
+        hat->mapping.down.target.pin  = JOYSTICK_DIRECTION_DOWN;
+        hat->mapping.left.action      = JOY_ACTION_JOYSTICK;
+        hat->mapping.left.target.pin  = JOYSTICK_DIRECTION_LEFT;
+        hat->mapping.right.action     = JOY_ACTION_JOYSTICK;
+        hat->mapping.right.target.pin = JOYSTICK_DIRECTION_RIGHT;
+    }
+    joy_device_compile_mappings(joydev);
+
+    hwdata = lib_malloc(sizeof *hwdata);
+    hwdata->spec      = *spec;
+    hwdata->step      = 0;
+    hwdata->generated = 0;
+    hwdata->start     = 0;
+    hwdata->opened    = false;
+    if (hwdata->spec.events_per_frame == 0) {
+        hwdata->spec.events_per_frame = 1;
+    }
+    joydev->hwdata = hwdata;
+    return joydev;
+}
+
+/** \brief  Get number of events generated by synthetic device since opening
+ *
+ * \param[in]   joydev  synthetic device
+ *
+ * \return  number of events
+ */
+uint64_t bench_synth_generated(const joy_device_t *joydev)
+{
+    const synth_hwdata_t *hwdata = joydev->hwdata;
+
+    return hwdata != NULL ? hwdata->generated : 0;
+}
+
+
+/** \brief  Poll synthetic devices until they generated enough events
+ *
+ * The port queue is drained after each device is polled, like an emulation
+ * thread that keeps up.
+ *
+ * \param[in]   devices devices
+ * \param[in]   count   number of devices
+ * \param[in]   events  minimum total number of events to generate
+ *
+ * \return  number of events generated
+ */
+static uint64_t poll_devices(joy_device_t **devices, uint32_t count, uint64_t events)
+{
+    joy_port_update_t updates[DRAIN_MAX];
+    uint64_t          total = 0;
+
+    while (total < events) {
+        total = 0;
+        for (uint32_t d = 0; d < count; d++) {
+            joy_poll(devices[d]);
+            while (joy_queue_drain(joy_port_queue(), updates, DRAIN_MAX) == DRAIN_MAX) {
+                /* NOP */
+            }
+            total += bench_synth_generated(devices[d]);
+        }
+    }
+    return total;
+}
+
+/** \brief  Run synthetic devices and report the cost per event
+ *
+ * Devices generating events at a set rate report the rate achieved instead,
+ * the time taken is determined by the rate.
+ *
+ * \param[in]   name    name of benchmark case
+ * \param[in]   spec    spec of each device
+ * \param[in]   count   number of devices
+ * \param[in]   events  minimum total number of events
+ */
+static void run_synth(const char *name, const synth_spec_t *spec, uint32_t count,
+                      uint64_t events)
+{
+    joy_device_t **devices = lib_malloc(count * sizeof *devices);
+    uint32_t       dropped = joy_queue_dropped(joy_port_queue());
+    uint64_t       start;
+    uint64_t       total;
+    uint64_t       elapsed;
+
+    bench_random_seed(count);
+    for (uint32_t d = 0; d < count; d++) {
+        devices[d] = bench_synth_device_new(spec, (int)(d % JOY_NUM_PORTS));
+        joy_open(devices[d]);
+    }
+
+    start   = bench_time_ns();
+    total   = poll_devices(devices, count, events);
+    elapsed = bench_time_ns() - start;
+    dropped = joy_queue_dropped(joy_port_queue()) - dropped;
+    if (spec->rate > 0) {
+        bench_report_rate(name, total, elapsed,
+                          (double)spec->rate * (double)count, dropped);
+    } else {
+        bench_report(name, total, elapsed);
+        if (dropped > 0) {
+            printf("%-40s %12"PRIu32" port updates dropped\n", "", dropped);
+        }
+    }
+
+    for (uint32_t d = 0; d < count; d++) {
+        joy_device_free(devices[d]);
+    }
+    lib_free(devices);
+}
+
+/** \brief  Benchmark polling, dispatch and port aggregation for 1-128 devices
+ *
+ * Each device is a gamepad with a random mix of events, the total number of
+ * events is the same for each device count.
+ */
+static void bench_synth_scaling(void)
+{
+    static const uint32_t counts[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    synth_spec_t spec = {
+        .num_axes         = 4,
+        .num_buttons      = 12,
+        .num_hats         = 1,
+        .pattern          = SYNTH_MIXED,
+        .events_per_poll  = 16,
+        .events_per_frame = 4,
+        .rate             = 0
+    };
+
+    bench_synth_register();
+    for (size_t c = 0; c < ARRAY_LEN(counts); c++) {
+        char name[64];
+
+        snprintf(name, sizeof name, "synth-%"PRIu32"-devices", counts[c]);
+        run_synth(name, &spec, counts[c], bench_iterations());
+    }
+}
+
+/** \brief  Benchmark the event patterns on a single device */
+static void bench_synth_patterns(void)
+{
+    static const struct {
+        const char      *name;
+        synth_pattern_t  pattern;
+    } patterns[] = {
+        { "synth-stick-sweep", SYNTH_STICK_SWEEP },
+        { "synth-button-mash", SYNTH_BUTTON_MASH },
+        { "synth-hat-spin",    SYNTH_HAT_SPIN },
+        { "synth-mixed",       SYNTH_MIXED }
+    };
+    synth_spec_t spec = {
+        .num_axes         = 2,
+        .num_buttons      = 4,
+        .num_hats         = 1,
+        .events_per_poll  = 64,
+        .events_per_frame = 1,
+        .rate             = 0
+    };
+
+    bench_synth_register();
+    for (size_t p = 0; p < ARRAY_LEN(patterns); p++) {
+        spec.pattern = patterns[p].pattern;
+        run_synth(patterns[p].name, &spec, 1, bench_iterations());
+    }
+}
+
+/** \brief  Benchmark frame sizes on a single device */
+static void bench_synth_frames(void)
+{
+    static const uint32_t sizes[] = { 1, 2, 4, 8, 16, 64 };
+    synth_spec_t spec = {
+        .num_axes         = 4,
+        .num_buttons      = 12,
+        .num_hats         = 1,
+        .pattern          = SYNTH_MIXED,
+        .events_per_poll  = 64,
+        .rate             = 0
+    };
+
+    bench_synth_register();
+    for (size_t s = 0; s < ARRAY_LEN(sizes); s++) {
+        char name[64];
+
+        spec.events_per_frame = sizes[s];
+        snprintf(name, sizeof name, "synth-frame-%"PRIu32, sizes[s]);
+        run_synth(name, &spec, 1, bench_iterations());
+    }
+}
+
+/** \brief  Check sustained rate of 64 devices generating events at a set rate */
+static void bench_synth_rate(void)
+{
+    static const uint64_t rates[] = { 1000, 10000, 100000 };
+    synth_spec_t spec = {
+        .num_axes         = 4,
+        .num_buttons      = 12,
+        .num_hats         = 1,
+        .pattern          = SYNTH_MIXED,
+        .events_per_poll  = 1024,
+        .events_per_frame = 4
+    };
+
+    bench_synth_register();
+    for (size_t r = 0; r < ARRAY_LEN(rates); r++) {
+        char name[64];
+
+        spec.rate = rates[r];
+        snprintf(name, sizeof name, "synth-64x%"PRIu64"-per-sec", rates[r]);
+        /* generate about 100 msec worth of events */
+        run_synth(name, &spec, 64, rates[r] * 64u / 10u);
+    }
+}
+
+
+/** \brief  List of synthetic load benchmarks */
+const bench_t bench_synth_list[] = {
+    {   .name = "synth-scaling",
+        .desc = "joy_poll(), dispatch and port updates for 1 to 128 devices",
+        .run  = bench_synth_scaling
+    },
+    {   .name = "synth-patterns",
+        .desc = "stick sweeps, button mashing, hat spins and a mix on one device",
+        .run  = bench_synth_patterns
+    },
+    {   .name = "synth-frames",
+        .desc = "events per submitted frame from 1 to 64",
+        .run  = bench_synth_frames
+    },
+    {   .name = "synth-rate",
+        .desc = "64 devices generating events at a set rate",
+        .run  = bench_synth_rate
+    },
+    BENCH_LIST_END
+};
@@ -0,0 +1,235 @@
+/** \file   vjm.c
+ * \brief   Parse throughput benchmark for large joymap files
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Generates joymap files with thousands of lines for a bench device and loads
+ * them with \c joymap_load(), reporting the time per line and the throughput
+ * in lines and megabytes per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "joyapi.h"
+#include "joymap.h"
+#include "lib.h"
+#include "uiactions.h"
+
+#include "bench.h"
+
+
+/** \brief  Number of axes of the bench device */
+#define VJM_AXES    16u
+
+/** \brief  Number of buttons of the bench device */
+#define VJM_BUTTONS 32u
+
+/** \brief  Number of hats of the bench device */
+#define VJM_HATS    4u
+
+
+/** \brief  Line types of generated joymaps */
+typedef enum vjm_line_e {
+    VJM_LINE_PIN_AXIS,      /**< map pin to axis direction */
+    VJM_LINE_PIN_BUTTON,    /**< map pin to button */
+    VJM_LINE_PIN_HAT,       /**< map pin to hat direction */
+    VJM_LINE_KEY,           /**< map key to button */
+    VJM_LINE_ACTION,        /**< map UI action to button */
+    VJM_LINE_CALIBRATE,     /**< axis calibration */
+    VJM_LINE_COMMENT,       /**< comment */
+    VJM_LINE_EMPTY,         /**< empty line */
+
+    VJM_LINE_TYPES          /**< number of line types */
+} vjm_line_t;
+
+/** \brief  Joymap sizes to benchmark */
+static const struct {
+    const char *name;   /**< name of benchmark case */
+    uint32_t    lines;  /**< number of lines */
+} vjm_sizes[] = {
+    { "joymap-parse-1k",    1000u },
+    { "joymap-parse-10k",   10000u },
+    { "joymap-parse-100k",  100000u }
+};
+
+
+/** \brief  Append a line to a generated joymap
+ *
+ * \param[in]   fp      file
+ * \param[in]   type    line type
+ * \param[in]   actions names of UI actions
+ * \param[in]   count   number of elements in \a actions
+ *
+ * \return  number of bytes written or -1 on error
+ */
+static int vjm_write_line(FILE        *fp,
+                          vjm_line_t   type,
+                          const char **actions,
+                          uint32_t     count)
+{
+    static const char *directions[] = { "up", "down", "left", "right" };
+    static const char *calibrations[] = { "threshold", "deadzone", "fuzz" };
+
+    uint32_t axis   = bench_random() % VJM_AXES;
+    uint32_t button = bench_random() % VJM_BUTTONS;
+    uint32_t hat    = bench_random() % VJM_HATS;
+    uint32_t pin    = bench_random() % 5u;
+    bool     pos    = (bench_random() & 1u) != 0;
+
+    switch (type) {
+        case VJM_LINE_PIN_AXIS:
+            return fprintf(fp, "map pin %-2u axis \"ABS_%"PRIu32"\" %s\n",
+                           1u << pin, axis, pos ? "positive" : "negative");
+        case VJM_LINE_PIN_BUTTON:
+            return fprintf(fp, "map pin %-2u button \"BTN_%"PRIu32"\"\n",
+                           1u << pin, button);
+        case VJM_LINE_PIN_HAT:
+            return fprintf(fp, "map pin %-2u hat \"HAT_%"PRIu32"\" %s\n",
+                           1u << pin, hat, directions[bench_random() % 4u]);
+        case VJM_LINE_KEY:
+            return fprintf(fp, "map key %"PRIu32" %"PRIu32" %"PRIu32" button \"BTN_%"PRIu32"\"\n",
+                           bench_random() % 8u, bench_random() % 8u,
+                           bench_random() % 4u, button);
+        case VJM_LINE_ACTION:
+            return fprintf(fp, "map action \"%s\" button \"BTN_%"PRIu32"\"\n",
+                           actions[bench_random() % count], button);
+        case VJM_LINE_CALIBRATE:
+            return fprintf(fp, "calibrate axis \"ABS_%"PRIu32"\" %s %s %"PRIu32"\n",
+                           axis, pos ? "positive" : "negative",
+                           calibrations[bench_random() % 3u],
+                           bench_random() % 32768u);
+        case VJM_LINE_COMMENT:
+            return fprintf(fp, "# mappings for axis %"PRIu32" and button %"PRIu32"\n",
+                           axis, button);
+        default:
+            return fprintf(fp, "\n");
+    }
+}
+
+/** \brief  Generate joymap file for the bench device
+ *
+ * Writes a header followed by random \c map and \c calibrate lines for the
+ * axes, buttons and hats of a device created with \c bench_device_new(), with
+ * some comments and empty lines in between. The same seed gives the same file.
+ *
+ * \param[in]   path    path of file to write
+ * \param[in]   lines   number of lines
+ * \param[in]   seed    seed for the pseudo random number generator
+ *
+ * \return  size of file in bytes or 0 on error
+ */
+static uint64_t vjm_generate(const char *path, uint32_t lines, uint32_t seed)
+{
+    const char *actions[ACTION_ID_COUNT];
+    uint32_t    count = 0;
+    uint64_t    size  = 0;
+    uint32_t    line;
+    FILE       *fp;
+    int         n;
+
+    for (int id = ACTION_NONE + 1; id < ACTION_ID_COUNT; id++) {
+        const char *name = ui_action_get_name(id);
+
+        if (name != NULL) {
+            actions[count++] = name;
+        }
+    }
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return 0;
+    }
+    n = fprintf(fp,
+                "# Generated joymap for the parse benchmark\n"
+                "vjm-version     2.0\n"
+                "device-vendor   0x1234\n"
+                "device-product  0x5678\n"
+                "device-version  0x0100\n"
+                "device-name     \"Bench device\"\n");
+    if (n < 0) {
+        fclose(fp);
+        return 0;
+    }
+    size += (uint64_t)n;
+
+    bench_random_seed(seed);
+    for (line = 6; line < lines; line++) {
+        n = vjm_write_line(fp, (vjm_line_t)(bench_random() % VJM_LINE_TYPES),
+                           actions, count);
+        if (n < 0) {
+            fclose(fp);
+            return 0;
+        }
+        size += (uint64_t)n;
+    }
+    if (fclose(fp) != 0) {
+        return 0;
+    }
+    return size;
+}
+
+
+/** \brief  Benchmark parsing of generated joymaps of increasing size
+ *
+ * About \c --iterations lines are parsed per case, so small joymaps are loaded
+ * many times and large ones only a few times.
+ */
+static void bench_joymap_parse(void)
+{
+    joy_device_t *joydev;
+    char         *path;
+
+    joydev = bench_device_new(VJM_AXES, VJM_BUTTONS, VJM_HATS);
+    path   = bench_tmp_path("vice-joydriver-bench-parse.vjm");
+
+    for (size_t s = 0; s < ARRAY_LEN(vjm_sizes); s++) {
+        uint64_t size;
+        uint64_t loads;
+        uint64_t start;
+        uint64_t elapsed;
+        uint64_t i;
+
+        size = vjm_generate(path, vjm_sizes[s].lines, (uint32_t)s + 1u);
+        if (size == 0) {
+            fprintf(stderr, "failed to write %s, skipping.\n", path);
+            break;
+        }
+        loads = bench_iterations() / vjm_sizes[s].lines;
+        if (loads == 0) {
+            loads = 1;
+        }
+
+        start = bench_time_ns();
+        for (i = 0; i < loads; i++) {
+            joymap_t *joymap = joymap_load(joydev, path);
+
+            if (joymap == NULL) {
+                fprintf(stderr, "failed to load %s.\n", path);
+                break;
+            }
+            joymap_free(joymap);
+        }
+        elapsed = bench_time_ns() - start;
+        if (i == loads) {
+            bench_report(vjm_sizes[s].name, loads * vjm_sizes[s].lines, elapsed);
+            bench_report_bytes(vjm_sizes[s].name, loads * size);
+        }
+    }
+
+    joy_device_free(joydev);
+    remove(path);
+    lib_free(path);
+}
+
+
+/** \brief  List of joymap parser benchmarks */
+const bench_t bench_vjm_list[] = {
+    {   .name = "joymap-parse",
+        .desc = "joymap_load() of generated joymaps with 1k, 10k and 100k lines",
+        .run  = bench_joymap_parse
+    },
+    BENCH_LIST_END
+};
@@ -50,6 +50,7 @@
 
 #include "lib.h"
 #include "joyapi.h"
+#include "joyrecord.h"
 
 
 #define ROOT_NODE       "/dev"
@@ -504,11 +505,13 @@ static bool joydev_poll(joy_device_t *joydev)
                         case HUG_RZ:    /* fall through */
                         case HUG_SLIDER:
                             /* axis */
+                            joy_record_event(joydev, JOY_INPUT_AXIS, (uint16_t)usage, value, 0);
                             joy_axis_event(joydev,
                                            joy_axis_from_code(joydev, (uint16_t)usage),
                                            value);
                             break;
                         case HUG_HAT_SWITCH:
+                            joy_record_event(joydev, JOY_INPUT_HAT, (uint16_t)usage, value, 0);
                             joy_hat_event(joydev,
                                           joy_hat_from_code(joydev, (uint16_t)usage),
                                           value);
@@ -518,6 +521,7 @@ static bool joydev_poll(joy_device_t *joydev)
                         case HUG_D_PAD_LEFT:    /* fall through */
                         case HUG_D_PAD_RIGHT:
                             /* D-Pad is mapped as buttons */
+                            joy_record_event(joydev, JOY_INPUT_BUTTON, (uint16_t)usage, value, 0);
                             joy_button_event(joydev,
                                              joy_button_from_code(joydev, (uint16_t)usage),
                                              value);
@@ -527,6 +531,7 @@ static bool joydev_poll(joy_device_t *joydev)
                     }
                     break;
                 case HUP_BUTTON:
+                    joy_record_event(joydev, JOY_INPUT_BUTTON, (uint16_t)usage, value, 0);
                     joy_button_event(joydev,
                                      joy_button_from_code(joydev, (uint16_t)usage),
                                      value);
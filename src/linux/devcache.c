@@ -0,0 +1,520 @@
+/** \file   devcache.c
+ * \brief   Linux device capability cache
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Cache of the device descriptions obtained by probing the event nodes, so
+ * devices that didn't change since the previous run can be listed without
+ * opening them and initializing libevdev.
+ *
+ * Entries are keyed by node path, the node's device number and change time,
+ * and the device's identity in sysfs (vendor, product, version and physical
+ * location), which all change when a different device gets the node.
+ *
+ * The cache is a simple text file:
+ * \verbatim
+ * VJDC 1
+ * device /dev/input/event3
+ * key <rdev> <ctime sec> <ctime nsec> <vendor> <product> <version> <phys>
+ * name <device name>
+ * axis <code> <min> <max> <fuzz> <flat> <resolution> <digital> <name>
+ * button <code> <name>
+ * end
+ * \endverbatim
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "joyapi.h"
+#include "lib.h"
+
+#include "devcache.h"
+#include "sysfs.h"
+
+
+/** \brief  Cache file magic and format version */
+#define DEVCACHE_MAGIC      "VJDC 1"
+
+/** \brief  Name of cache file in the cache directory */
+#define DEVCACHE_FILENAME   "vice-joydriver-devices.cache"
+
+/** \brief  Maximum length of a line in the cache file */
+#define LINE_MAX_LEN        1024
+
+#define ENTRIES_INITIAL_SIZE    16
+
+
+/** \brief  Identity of a device behind a node */
+typedef struct devcache_key_s {
+    uint64_t  rdev;         /**< device number of node */
+    int64_t   ctime_sec;    /**< node change time, seconds */
+    long      ctime_nsec;   /**< node change time, nanoseconds */
+    uint16_t  vendor;       /**< vendor ID from sysfs */
+    uint16_t  product;      /**< product ID from sysfs */
+    uint16_t  version;      /**< product version from sysfs */
+    char     *phys;         /**< physical location from sysfs */
+} devcache_key_t;
+
+/** \brief  Cache entry */
+typedef struct devcache_entry_s {
+    devcache_key_t  key;    /**< identity of device */
+    joy_device_t   *joydev; /**< device description */
+    bool            used;   /**< entry was used this run, keep when saving */
+} devcache_entry_t;
+
+
+static devcache_entry_t *entries;
+static size_t            entries_count;
+static size_t            entries_size;
+static bool              dirty;
+
+
+/** \brief  Determine identity of device behind node
+ *
+ * \param[in]   node    event node
+ * \param[out]  key     identity, free \c phys with \c lib_free()
+ *
+ * \return  \c false if the node doesn't exist
+ */
+static bool key_from_node(const char *node, devcache_key_t *key)
+{
+    struct stat st;
+
+    if (stat(node, &st) != 0) {
+        return false;
+    }
+    key->rdev       = (uint64_t)st.st_rdev;
+    key->ctime_sec  = (int64_t)st.st_ctim.tv_sec;
+    key->ctime_nsec = st.st_ctim.tv_nsec;
+    key->vendor     = sysfs_read_id(node, "id/vendor");
+    key->product    = sysfs_read_id(node, "id/product");
+    key->version    = sysfs_read_id(node, "id/version");
+    key->phys       = sysfs_read(node, "phys");
+    if (key->phys == NULL) {
+        key->phys = lib_strdup("");
+    }
+    return true;
+}
+
+/** \brief  Compare device identities
+ *
+ * \param[in]   a   first identity
+ * \param[in]   b   second identity
+ *
+ * \return  \c true if equal
+ */
+static bool key_equal(const devcache_key_t *a, const devcache_key_t *b)
+{
+    return a->rdev       == b->rdev       &&
+           a->ctime_sec  == b->ctime_sec  &&
+           a->ctime_nsec == b->ctime_nsec &&
+           a->vendor     == b->vendor     &&
+           a->product    == b->product    &&
+           a->version    == b->version    &&
+           strcmp(a->phys, b->phys) == 0;
+}
+
+/** \brief  Create copy of device description
+ *
+ * Copies the description obtained by probing: node, name, IDs, axes and
+ * buttons. The copy has no hwdata, mappings or lookup tables.
+ *
+ * \param[in]   src device
+ *
+ * \return  new device
+ */
+static joy_device_t *device_copy(const joy_device_t *src)
+{
+    joy_device_t *dev = joy_device_new();
+
+    dev->name    = lib_strdup(src->name);
+    dev->node    = lib_strdup(src->node);
+    dev->vendor  = src->vendor;
+    dev->product = src->product;
+    dev->version = src->version;
+
+    if (src->num_axes > 0) {
+        dev->axes = lib_malloc(src->num_axes * sizeof *(dev->axes));
+        for (uint32_t a = 0; a < src->num_axes; a++) {
+            const joy_axis_t *sa   = &(src->axes[a]);
+            joy_axis_t       *axis = &(dev->axes[a]);
+
+            joy_axis_init(axis);
+            axis->code       = sa->code;
+            axis->name       = lib_strdup(sa->name);
+            axis->minimum    = sa->minimum;
+            axis->maximum    = sa->maximum;
+            axis->fuzz       = sa->fuzz;
+            axis->flat       = sa->flat;
+            axis->resolution = sa->resolution;
+            axis->digital    = sa->digital;
+            joy_axis_auto_calibrate(axis);
+        }
+    }
+    dev->num_axes = src->num_axes;
+
+    if (src->num_buttons > 0) {
+        dev->buttons = lib_malloc(src->num_buttons * sizeof *(dev->buttons));
+        for (uint32_t b = 0; b < src->num_buttons; b++) {
+            joy_button_t *button = &(dev->buttons[b]);
+
+            joy_button_init(button);
+            button->code = src->buttons[b].code;
+            button->name = lib_strdup(src->buttons[b].name);
+        }
+    }
+    dev->num_buttons = src->num_buttons;
+    dev->num_hats    = 0;
+    return dev;
+}
+
+/** \brief  Append entry to the cache
+ *
+ * \param[in]   key     device identity (ownership of \c phys is taken)
+ * \param[in]   joydev  device description (ownership is taken)
+ * \param[in]   used    entry is used this run
+ */
+static void entry_append(devcache_key_t *key, joy_device_t *joydev, bool used)
+{
+    devcache_entry_t *entry;
+
+    if (entries_count == entries_size) {
+        entries_size = entries_size == 0 ? ENTRIES_INITIAL_SIZE : entries_size * 2u;
+        entries      = lib_realloc(entries, entries_size * sizeof *entries);
+    }
+    entry         = &(entries[entries_count++]);
+    entry->key    = *key;
+    entry->joydev = joydev;
+    entry->used   = used;
+}
+
+/** \brief  Find entry by node
+ *
+ * \param[in]   node    event node
+ *
+ * \return  entry or \c NULL
+ */
+static devcache_entry_t *entry_find(const char *node)
+{
+    for (size_t i = 0; i < entries_count; i++) {
+        if (strcmp(entries[i].joydev->node, node) == 0) {
+            return &(entries[i]);
+        }
+    }
+    return NULL;
+}
+
+
+/** \brief  Get default path of cache file
+ *
+ * \return  heap-allocated path in \c $XDG_CACHE_HOME or \c $HOME/.cache, or
+ *          \c NULL if neither is set
+ */
+char *devcache_default_path(void)
+{
+    const char *dir  = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (dir != NULL && *dir != '\0') {
+        return util_concat(dir, "/", DEVCACHE_FILENAME, NULL);
+    }
+    if (home != NULL && *home != '\0') {
+        return util_concat(home, "/.cache/", DEVCACHE_FILENAME, NULL);
+    }
+    return NULL;
+}
+
+
+/** \brief  Load cache from file
+ *
+ * A missing file is not an error, the cache simply starts out empty.
+ *
+ * \param[in]   path    path to cache file
+ *
+ * \return  \c false if the file exists but could not be parsed
+ */
+bool devcache_load(const char *path)
+{
+    char            line[LINE_MAX_LEN];
+    FILE           *fp;
+    joy_device_t   *dev     = NULL;
+    devcache_key_t  key     = { 0 };
+    uint32_t        a_size  = 0;
+    uint32_t        b_size  = 0;
+    bool            result  = true;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        msg_debug("no cache at %s: %s\n", path, strerror(errno));
+        return true;
+    }
+    if (fgets(line, (int)sizeof line, fp) == NULL ||
+            strncmp(line, DEVCACHE_MAGIC, strlen(DEVCACHE_MAGIC)) != 0) {
+        msg_debug("invalid cache file %s, ignoring\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    while (result && fgets(line, (int)sizeof line, fp) != NULL) {
+        int n = 0;
+
+        lib_strrtrim(line);
+        if (strncmp(line, "device ", 7) == 0) {
+            if (dev != NULL) {
+                result = false;
+                break;
+            }
+            dev         = joy_device_new();
+            dev->node   = lib_strdup(line + 7);
+            key.phys    = NULL;
+            a_size      = 0;
+            b_size      = 0;
+
+        } else if (dev == NULL) {
+            result = false;
+
+        } else if (strncmp(line, "key ", 4) == 0) {
+            unsigned int vendor;
+            unsigned int product;
+            unsigned int version;
+
+            if (sscanf(line + 4, "%"SCNu64" %"SCNd64" %ld %x %x %x%n",
+                       &key.rdev, &key.ctime_sec, &key.ctime_nsec,
+                       &vendor, &product, &version, &n) < 6) {
+                result = false;
+            } else {
+                key.vendor  = (uint16_t)vendor;
+                key.product = (uint16_t)product;
+                key.version = (uint16_t)version;
+                lib_free(key.phys);
+                key.phys    = lib_strdup(util_skip_whitespace(line + 4 + n));
+            }
+
+        } else if (strncmp(line, "name ", 5) == 0) {
+            lib_free(dev->name);
+            dev->name = lib_strdup(line + 5);
+            /* also used for the IDs as reported by libevdev */
+            dev->vendor  = key.vendor;
+            dev->product = key.product;
+            dev->version = key.version;
+
+        } else if (strncmp(line, "axis ", 5) == 0) {
+            joy_axis_t   axis;
+            unsigned int code;
+            int          digital;
+
+            joy_axis_init(&axis);
+            if (sscanf(line + 5, "%x %"SCNd32" %"SCNd32" %"SCNd32" %"SCNd32" %"SCNd32" %d%n",
+                       &code, &axis.minimum, &axis.maximum, &axis.fuzz,
+                       &axis.flat, &axis.resolution, &digital, &n) < 7) {
+                result = false;
+                break;
+            }
+            axis.code    = (uint16_t)code;
+            axis.digital = digital != 0;
+            axis.name    = lib_strdup(util_skip_whitespace(line + 5 + n));
+            if (dev->num_axes == a_size) {
+                a_size    = a_size == 0 ? 16u : a_size * 2u;
+                dev->axes = lib_realloc(dev->axes, a_size * sizeof *(dev->axes));
+            }
+            dev->axes[dev->num_axes++] = axis;
+
+        } else if (strncmp(line, "button ", 7) == 0) {
+            joy_button_t button;
+            unsigned int code;
+
+            joy_button_init(&button);
+            if (sscanf(line + 7, "%x%n", &code, &n) < 1) {
+                result = false;
+                break;
+            }
+            button.code = (uint16_t)code;
+            button.name = lib_strdup(util_skip_whitespace(line + 7 + n));
+            if (dev->num_buttons == b_size) {
+                b_size       = b_size == 0 ? 32u : b_size * 2u;
+                dev->buttons = lib_realloc(dev->buttons, b_size * sizeof *(dev->buttons));
+            }
+            dev->buttons[dev->num_buttons++] = button;
+
+        } else if (strcmp(line, "end") == 0) {
+            if (key.phys == NULL || dev->name == NULL) {
+                result = false;
+                break;
+            }
+            entry_append(&key, dev, false);
+            dev      = NULL;
+            key.phys = NULL;
+
+        } else {
+            result = false;
+        }
+    }
+    fclose(fp);
+
+    if (dev != NULL) {
+        /* incomplete entry */
+        joy_device_free(dev);
+        lib_free(key.phys);
+        result = false;
+    }
+    if (!result) {
+        msg_error("failed to parse cache file %s, ignoring it\n", path);
+        devcache_free();
+        /* rewrite the cache */
+        dirty = true;
+    }
+    return result;
+}
+
+
+/** \brief  Save cache to file
+ *
+ * Only entries used during this run are written, so entries for nodes that
+ * no longer exist are dropped. Nothing is written if the cache didn't change.
+ *
+ * \param[in]   path    path to cache file
+ *
+ * \return  \c true on success
+ */
+bool devcache_save(const char *path)
+{
+    FILE *fp;
+    char *tmp;
+    bool  result = true;
+
+    for (size_t i = 0; i < entries_count; i++) {
+        if (!entries[i].used) {
+            dirty = true;
+        }
+    }
+    if (!dirty) {
+        return true;
+    }
+
+    /* write to temporary file and rename, so concurrent runs never see a
+     * partial cache */
+    tmp = util_concat(path, ".tmp", NULL);
+    fp  = fopen(tmp, "w");
+    if (fp == NULL) {
+        msg_debug("failed to write cache %s: %s\n", tmp, strerror(errno));
+        lib_free(tmp);
+        return false;
+    }
+
+    fprintf(fp, "%s\n", DEVCACHE_MAGIC);
+    for (size_t i = 0; i < entries_count; i++) {
+        const devcache_entry_t *entry = &(entries[i]);
+        const devcache_key_t   *key   = &(entry->key);
+        const joy_device_t     *dev   = entry->joydev;
+
+        if (!entry->used) {
+            continue;
+        }
+        fprintf(fp, "device %s\n", dev->node);
+        fprintf(fp, "key %"PRIu64" %"PRId64" %ld %04x %04x %04x %s\n",
+                key->rdev, key->ctime_sec, key->ctime_nsec,
+                (unsigned int)key->vendor, (unsigned int)key->product,
+                (unsigned int)key->version, key->phys);
+        fprintf(fp, "name %s\n", dev->name);
+        for (uint32_t a = 0; a < dev->num_axes; a++) {
+            const joy_axis_t *axis = &(dev->axes[a]);
+
+            fprintf(fp, "axis %04x %"PRId32" %"PRId32" %"PRId32" %"PRId32" %"PRId32" %d %s\n",
+                    (unsigned int)axis->code, axis->minimum, axis->maximum,
+                    axis->fuzz, axis->flat, axis->resolution,
+                    axis->digital ? 1 : 0, axis->name);
+        }
+        for (uint32_t b = 0; b < dev->num_buttons; b++) {
+            fprintf(fp, "button %04x %s\n",
+                    (unsigned int)dev->buttons[b].code, dev->buttons[b].name);
+        }
+        fprintf(fp, "end\n");
+    }
+
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        msg_debug("failed to write cache %s: %s\n", path, strerror(errno));
+        remove(tmp);
+        result = false;
+    } else {
+        dirty = false;
+    }
+    lib_free(tmp);
+    return result;
+}
+
+
+/** \brief  Free all cache entries */
+void devcache_free(void)
+{
+    for (size_t i = 0; i < entries_count; i++) {
+        lib_free(entries[i].key.phys);
+        joy_device_free(entries[i].joydev);
+    }
+    lib_free(entries);
+    entries       = NULL;
+    entries_count = 0;
+    entries_size  = 0;
+}
+
+
+/** \brief  Get device description from cache
+ *
+ * Look up \a node and verify the device behind it is still the same one.
+ * Can be called from multiple threads at once, as long as no thread calls
+ * \c devcache_store() or looks up the same node.
+ *
+ * \param[in]   node    event node
+ *
+ * \return  new device without hwdata, or \c NULL on a cache miss
+ */
+joy_device_t *devcache_lookup(const char *node)
+{
+    devcache_entry_t *entry = entry_find(node);
+    devcache_key_t    key;
+    bool              hit;
+
+    if (entry == NULL || !key_from_node(node, &key)) {
+        return NULL;
+    }
+    hit = key_equal(&key, &(entry->key));
+    lib_free(key.phys);
+    if (!hit) {
+        return NULL;
+    }
+    entry->used = true;
+    return device_copy(entry->joydev);
+}
+
+
+/** \brief  Add or update device description in the cache
+ *
+ * \param[in]   joydev  device obtained by probing its node
+ */
+void devcache_store(const joy_device_t *joydev)
+{
+    devcache_entry_t *entry;
+    devcache_key_t    key;
+
+    if (!key_from_node(joydev->node, &key)) {
+        return;
+    }
+    entry = entry_find(joydev->node);
+    if (entry != NULL) {
+        lib_free(entry->key.phys);
+        joy_device_free(entry->joydev);
+        entry->key    = key;
+        entry->joydev = device_copy(joydev);
+        entry->used   = true;
+    } else {
+        entry_append(&key, device_copy(joydev), true);
+    }
+    dirty = true;
+}
@@ -0,0 +1,19 @@
+/** \file   devcache.h
+ * \brief   Linux device capability cache - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef VICE_DEVCACHE_H
+#define VICE_DEVCACHE_H
+
+#include <stdbool.h>
+#include "joyapi-types.h"
+
+bool          devcache_load  (const char *path);
+bool          devcache_save  (const char *path);
+void          devcache_free  (void);
+char         *devcache_default_path(void);
+joy_device_t *devcache_lookup(const char *node);
+void          devcache_store (const joy_device_t *joydev);
+
+#endif
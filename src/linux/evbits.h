@@ -0,0 +1,34 @@
+/** \file   evbits.h
+ * \brief   Helpers for evdev capability bitmaps
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Capability bitmaps, as returned by \c EVIOCGBIT and exposed in sysfs, are
+ * arrays of longs with bit N of the map in bit (N % BITS_PER_LONG) of long
+ * (N / BITS_PER_LONG).
+ */
+
+#ifndef VICE_EVBITS_H
+#define VICE_EVBITS_H
+
+#include <stdbool.h>
+#include <limits.h>
+
+/** \brief  Number of bits in a long, the unit of capability bitmaps */
+#define BITS_PER_LONG           (sizeof(unsigned long) * CHAR_BIT)
+
+/** \brief  Number of longs required for a bitmap of \a n bits */
+#define BITS_TO_LONGS(n)        (((n) + BITS_PER_LONG - 1u) / BITS_PER_LONG)
+
+/** \brief  Test if bit is set in capability bitmap
+ *
+ * \param[in]   bits    bitmap
+ * \param[in]   bit     bit number
+ *
+ * \return  \c true if set
+ */
+static inline bool bit_is_set(const unsigned long *bits, unsigned int bit)
+{
+    return (bits[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1ul;
+}
+
+#endif
@@ -15,21 +15,35 @@
 #include <fcntl.h>
 #include <libevdev/libevdev.h>
 #include <linux/input.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "joyapi.h"
+#include "joyrecord.h"
 #include "lib.h"
 
+#include "devcache.h"
+#include "evbits.h"
+#include "sysfs.h"
+
 
 extern bool debug;
 extern bool verbose;
+/* number of threads to probe nodes with (--probe-threads, 0 = automatic) */
+extern int  probe_threads;
+/* don't use the device cache (--no-device-cache) */
+extern bool no_device_cache;
+/* msecs to keep probe file descriptors open for reuse (--probe-fd-timeout) */
+extern int  probe_fd_timeout;
 
 
-#define DEVICES_INITIAL_SIZE    16
-#define BUTTONS_INITIAL_SIZE    32
-#define AXES_INITIAL_SIZE       16
 #define HATS_INITIAL_SIZE       4
 
 #define NODE_ROOT               "/dev/input"
@@ -38,6 +52,20 @@ extern bool verbose;
 #define NODE_PREFIX             "event"
 #define NODE_PREFIX_LEN         5
 
+#define EPOLL_MAX_EVENTS        16
+
+/** \brief  Maximum number of events read from a device per \c read() call */
+#define READ_MAX_EVENTS         64
+
+/** \brief  Maximum number of distinct axes and buttons changing in a frame
+ *
+ * A frame with more changes is submitted in parts.
+ */
+#define FRAME_MAX_EVENTS        32
+
+/** \brief  Maximum number of threads used to probe nodes */
+#define PROBE_THREADS_MAX       8
+
 
 /** \brief  Hat event codes for both axes
  */
@@ -58,8 +86,28 @@ typedef struct {
  * \c close() driver callbacks, freed via the driver's \c hwdata_free() callback.
  */
 typedef struct hwdata_s {
-    struct libevdev *evdev;     /**< evdev instance */
-    int              fd;        /**< file descriptor */
+    int                 fd;             /**< file descriptor */
+    int                 probe_fd;       /**< file descriptor kept open after
+                                             probing, for \c open() to reuse
+                                             (-1 = none) */
+    uint64_t            probe_time;     /**< time \c probe_fd was opened (usec) */
+    bool                unplugged;      /**< device node was removed */
+    bool                replugged;      /**< a new node with the same name was
+                                             created since, probe it once this
+                                             device is removed */
+    bool                lost;           /**< input thread stopped polling the
+                                             device because it failed */
+    bool                dropped;        /**< events were dropped by the kernel,
+                                             ignore events until the next
+                                             \c SYN_REPORT */
+    uint64_t            num_reads;      /**< number of \c read() calls since
+                                             opening */
+    uint64_t            num_events;     /**< number of events read since opening */
+    uint32_t            frame_count;    /**< number of events in \c frame */
+    struct input_event  events[READ_MAX_EVENTS];    /**< buffer for \c read() */
+    struct input_event  frame[FRAME_MAX_EVENTS];    /**< last value of each axis
+                                                         and button changed in
+                                                         the current frame */
 } hwdata_t;
 
 
@@ -91,22 +139,117 @@ static hwdata_t *hwdata_new(void)
 {
     hwdata_t *hwdata= lib_malloc(sizeof *hwdata);
 
-    hwdata->evdev = NULL;
-    hwdata->fd    = -1;
+    hwdata->fd         = -1;
+    hwdata->probe_fd   = -1;
+    hwdata->probe_time = 0;
+    hwdata->unplugged  = false;
+    hwdata->replugged  = false;
+    hwdata->lost       = false;
+    hwdata->dropped     = false;
+    hwdata->num_reads   = 0;
+    hwdata->num_events  = 0;
+    hwdata->frame_count = 0;
     return hwdata;
 }
 
+/** \brief  Number of file descriptors kept open after probing
+ *
+ * Lets \c probe_fd_expire() return right away when there is nothing to do.
+ * Probing happens in multiple threads, so only access atomically.
+ */
+static int probe_fds_open = 0;
+
+/** \brief  Close file descriptor kept open after probing, if any
+ *
+ * \param[in]   hwdata  hardware-specific data
+ */
+static void probe_fd_release(hwdata_t *hwdata)
+{
+    if (hwdata->probe_fd >= 0) {
+        close(hwdata->probe_fd);
+        hwdata->probe_fd = -1;
+        __atomic_sub_fetch(&probe_fds_open, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/** \brief  Determine if file descriptor kept open after probing timed out
+ *
+ * \param[in]   hwdata  hardware-specific data
+ * \param[in]   now     current time in microseconds
+ *
+ * \return  \c true if kept open longer than \c --probe-fd-timeout
+ */
+static bool probe_fd_expired(const hwdata_t *hwdata, uint64_t now)
+{
+    return now - hwdata->probe_time > (uint64_t)probe_fd_timeout * 1000u;
+}
+
+/** \brief  Close file descriptors kept open after probing that timed out
+ *
+ * Called after enumeration and periodically while polling, so the nodes of
+ * devices that are never opened don't stay open.
+ *
+ * \param[in]   devices device list (can be \c NULL)
+ */
+static void probe_fd_expire(joy_device_t **devices)
+{
+    uint64_t now;
+
+    if (devices == NULL || __atomic_load_n(&probe_fds_open, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    now = joy_time_us();
+    for (size_t i = 0; devices[i] != NULL; i++) {
+        hwdata_t *hwdata = devices[i]->hwdata;
+
+        if (hwdata != NULL && hwdata->probe_fd >= 0 && probe_fd_expired(hwdata, now)) {
+            msg_debug("probe fd %d of %s timed out\n", hwdata->probe_fd, devices[i]->node);
+            probe_fd_release(hwdata);
+        }
+    }
+}
+
+/** \brief  Take file descriptor kept open after probing
+ *
+ * Descriptors kept open longer than \c --probe-fd-timeout are closed instead,
+ * the device might have been replaced by another one in the meantime. Events
+ * that arrived since probing are discarded, the device state was obtained
+ * when probing.
+ *
+ * \param[in]   hwdata  hardware-specific data
+ *
+ * \return  file descriptor or -1 if none was kept or it timed out
+ */
+static int probe_fd_take(hwdata_t *hwdata)
+{
+    struct input_event events[16];
+    int                fd = hwdata->probe_fd;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (probe_fd_expired(hwdata, joy_time_us())) {
+        msg_debug("probe fd %d timed out\n", fd);
+        probe_fd_release(hwdata);
+        return -1;
+    }
+    hwdata->probe_fd = -1;
+    __atomic_sub_fetch(&probe_fds_open, 1, __ATOMIC_RELAXED);
+    while (read(fd, events, sizeof events) > 0) {
+        /* NOP */
+    }
+    return fd;
+}
+
 static void hwdata_free(void *hwdata)
 {
     hwdata_t *hw = hwdata;
 
     if (hw != NULL) {
-        if (hw->evdev) {
-            libevdev_free(hw->evdev);
-        }
         if (hw->fd >= 0) {
             close(hw->fd);
         }
+        probe_fd_release(hw);
     }
     lib_free(hwdata);
 }
@@ -138,35 +281,115 @@ static char *node_full_path(const char *node)
     return path;
 }
 
-static void scan_buttons(joy_device_t *joydev, struct libevdev *evdev)
+/** \brief  Clear bits outside of range in capability bitmap
+ *
+ * \param[in,out]   bits    bitmap
+ * \param[in]       nlongs  number of longs in \a bits
+ * \param[in]       first   first bit to keep
+ * \param[in]       end     bit after last bit to keep
+ */
+static void bits_clamp(unsigned long *bits, size_t nlongs,
+                       unsigned int first, unsigned int end)
+{
+    for (size_t i = 0; i < nlongs; i++) {
+        unsigned int lo = (unsigned int)(i * BITS_PER_LONG);
+        unsigned int hi = lo + (unsigned int)BITS_PER_LONG;
+
+        if (hi <= first || lo >= end) {
+            bits[i] = 0;
+            continue;
+        }
+        if (first > lo) {
+            bits[i] &= ~0ul << (first - lo);
+        }
+        if (end < hi) {
+            bits[i] &= ~0ul >> (hi - end);
+        }
+    }
+}
+
+/** \brief  Count bits set in capability bitmap
+ *
+ * \param[in]   bits    bitmap
+ * \param[in]   nlongs  number of longs in \a bits
+ *
+ * \return  number of bits set
+ */
+static uint32_t bits_count(const unsigned long *bits, size_t nlongs)
 {
     uint32_t num = 0;
 
-    if (libevdev_has_event_type(evdev, EV_KEY)) {
-        size_t       size;
-        unsigned int code;
+    for (size_t i = 0; i < nlongs; i++) {
+        num += (uint32_t)__builtin_popcountl(bits[i]);
+    }
+    return num;
+}
 
-        size = BUTTONS_INITIAL_SIZE;
-        joydev->buttons = lib_malloc(size * sizeof *(joydev->buttons));
+/** \brief  Get next set bit in capability bitmap and clear it
+ *
+ * \param[in,out]   bits    bitmap
+ * \param[in]       nlongs  number of longs in \a bits
+ * \param[in,out]   index   index of long to start looking at
+ *
+ * \return  bit number, or -1 when no more bits are set
+ */
+static int bits_next(unsigned long *bits, size_t nlongs, size_t *index)
+{
+    while (*index < nlongs) {
+        unsigned long word = bits[*index];
 
-        for (code = BTN_MISC; code < KEY_MAX && num < UINT16_MAX; code++) {
-            if (libevdev_has_event_code(evdev, EV_KEY, code)) {
-                joy_button_t *button;
+        if (word != 0) {
+            int bit = __builtin_ctzl(word);
 
-                if (num == size) {
-                    size *= 2u;
-                    joydev->buttons = lib_realloc(joydev->buttons,
-                                                  size * sizeof *(joydev->buttons));
-                }
-                button = &(joydev->buttons[num++]);
-                joy_button_init(button);
-                button->code = (uint16_t)code;
-                button->name = lib_strdup(libevdev_event_code_get_name(EV_KEY, code));
-                //printf("%s\n", button->name);
-            }
+            bits[*index] = word & (word - 1ul);
+            return (int)(*index * BITS_PER_LONG) + bit;
         }
+        (*index)++;
+    }
+    return -1;
+}
+
+/** \brief  Get capability bitmap of event type from device
+ *
+ * \param[in]   fd      file descriptor of device node
+ * \param[in]   type    event type (\c 0 for the event types themselves)
+ * \param[out]  bits    bitmap
+ * \param[in]   size    size of \a bits in bytes
+ *
+ * \return  \c true on success
+ */
+static bool get_bits(int fd, unsigned int type, unsigned long *bits, size_t size)
+{
+    memset(bits, 0, size);
+    return ioctl(fd, EVIOCGBIT(type, size), bits) >= 0;
+}
+
+static void scan_buttons(joy_device_t *joydev, int fd)
+{
+    unsigned long bits[BITS_TO_LONGS(KEY_CNT)];
+    uint32_t      num;
+    size_t        index = 0;
+    int           code;
+
+    joydev->num_buttons = 0;
+    if (!get_bits(fd, EV_KEY, bits, sizeof bits)) {
+        return;
+    }
+    /* we're only interested in buttons, not keyboard keys */
+    bits_clamp(bits, ARRAY_LEN(bits), BTN_MISC, KEY_MAX);
+    num = bits_count(bits, ARRAY_LEN(bits));
+    if (num == 0) {
+        return;
+    }
+
+    joydev->buttons = lib_malloc(num * sizeof *(joydev->buttons));
+    while ((code = bits_next(bits, ARRAY_LEN(bits), &index)) >= 0) {
+        joy_button_t *button = &(joydev->buttons[joydev->num_buttons++]);
+
+        joy_button_init(button);
+        button->code = (uint16_t)code;
+        button->name = lib_strdup(libevdev_event_code_get_name(EV_KEY, (unsigned int)code));
     }
-    joydev->num_buttons = num;
 }
 
 
@@ -189,63 +412,67 @@ static bool axis_is_digital(joy_axis_t *axis)
 }
 
 
-static void scan_axes(joy_device_t *joydev, struct libevdev *evdev)
+static void scan_axes(joy_device_t *joydev, int fd)
 {
-    uint32_t num = 0;
-
-    if (libevdev_has_event_type(evdev, EV_ABS)) {
-        unsigned int code;
-        size_t      size;
-
-        size = AXES_INITIAL_SIZE;
-        joydev->axes = lib_malloc(size * sizeof *(joydev->axes));
-
-        for (code = ABS_X; code < ABS_RESERVED && num < UINT16_MAX; code++) {
-            if (libevdev_has_event_code(evdev, EV_ABS, code)) {
-                const struct input_absinfo *absinfo;
-                joy_axis_t                 *axis;
-
-                if (num == size) {
-                    size *= 2u;
-                    joydev->axes = lib_realloc(joydev->axes,
-                                               size * sizeof *(joydev->axes));
-                }
-
-                absinfo = libevdev_get_abs_info(evdev, code);
-                axis    = &(joydev->axes[num]);
-                joy_axis_init(axis);
-                axis->code = (uint16_t)code;
-                axis->name = lib_strdup(libevdev_event_code_get_name(EV_ABS, code));
-                //printf("axis name = %s\n", axis->name);
-                if (absinfo != NULL) {
-                    axis->minimum    = absinfo->minimum;
-                    axis->maximum    = absinfo->maximum;
-                    axis->fuzz       = absinfo->fuzz;
-                    axis->flat       = absinfo->flat;
-                    axis->resolution = absinfo->resolution;
-                } else {
-                    axis->minimum    = INT16_MIN;
-                    axis->maximum    = INT16_MAX;
-                }
-
-                /* determine if we're dealing with a digital or an analog axis */
-                axis->digital = axis_is_digital(axis);
-                /* auto-calibrate */
-                joy_axis_auto_calibrate(axis);
+    unsigned long bits[BITS_TO_LONGS(ABS_CNT)];
+    uint32_t      num;
+    size_t        index = 0;
+    int           code;
+
+    joydev->num_axes = 0;
+    if (!get_bits(fd, EV_ABS, bits, sizeof bits)) {
+        return;
+    }
+    bits_clamp(bits, ARRAY_LEN(bits), ABS_X, ABS_RESERVED);
+    num = bits_count(bits, ARRAY_LEN(bits));
+    if (num == 0) {
+        return;
+    }
 
-                num++;
-            }
+    joydev->axes = lib_malloc(num * sizeof *(joydev->axes));
+    while ((code = bits_next(bits, ARRAY_LEN(bits), &index)) >= 0) {
+        struct input_absinfo  absinfo;
+        joy_axis_t           *axis = &(joydev->axes[joydev->num_axes++]);
+
+        joy_axis_init(axis);
+        axis->code = (uint16_t)code;
+        axis->name = lib_strdup(libevdev_event_code_get_name(EV_ABS, (unsigned int)code));
+        if (ioctl(fd, EVIOCGABS((unsigned int)code), &absinfo) >= 0) {
+            axis->minimum    = absinfo.minimum;
+            axis->maximum    = absinfo.maximum;
+            axis->fuzz       = absinfo.fuzz;
+            axis->flat       = absinfo.flat;
+            axis->resolution = absinfo.resolution;
+        } else {
+            axis->minimum    = INT16_MIN;
+            axis->maximum    = INT16_MAX;
         }
+
+        /* determine if we're dealing with a digital or an analog axis */
+        axis->digital = axis_is_digital(axis);
+        /* auto-calibrate */
+        joy_axis_auto_calibrate(axis);
     }
-    joydev->num_axes = num;
 }
 
+/** \brief  Probe device node
+ *
+ * Query the device's name, ID and capabilities directly with ioctls instead
+ * of through libevdev: \c libevdev_new_from_fd() retrieves the complete state
+ * of the device (all event types, key states, abs info of all axes, LEDs,
+ * etc.), most of which we don't need during enumeration.
+ *
+ * \param[in]   node    path to device node
+ *
+ * \return  new device or \c NULL if \a node isn't an evdev device
+ */
 static joy_device_t *get_device_data(const char *node)
 {
-    struct libevdev *evdev;
-    joy_device_t    *joydev;
-    int              fd;
-    int              rc;
+    joy_device_t   *joydev;
+    struct input_id id;
+    char            name[256];
+    unsigned long   types[BITS_TO_LONGS(EV_CNT)];
+    int             fd;
 
     fd = open(node, O_RDONLY|O_NONBLOCK);
     if (fd < 0) {
@@ -255,92 +482,266 @@ static joy_device_t *get_device_data(const char *node)
         return NULL;
     }
 
-    msg_debug("Calling libevdev_new_from_fd(%d)\n", fd);
-    rc = libevdev_new_from_fd(fd, &evdev);
-    if (rc < 0) {
-        fprintf(stderr, "%s(): failed to initialize libevdev: %s\n",
-                __func__, strerror(-rc));
+    if (!get_bits(fd, 0, types, sizeof types) ||
+            ioctl(fd, EVIOCGID, &id) < 0 ||
+            ioctl(fd, EVIOCGNAME(sizeof name), name) < 0) {
+        fprintf(stderr, "%s(): failed to query %s: %s\n",
+                __func__, node, strerror(errno));
         close(fd);
         return NULL;
     }
-    msg_debug("OK\n");
+    name[sizeof name - 1u] = '\0';
 
     joydev = joy_device_new();
-    joydev->name    = lib_strdup(libevdev_get_name(evdev));
+    joydev->name    = lib_strdup(name);
     joydev->node    = lib_strdup(node);
-    joydev->vendor  = (uint16_t)libevdev_get_id_vendor(evdev);
-    joydev->product = (uint16_t)libevdev_get_id_product(evdev);
-    joydev->version = (uint16_t)libevdev_get_id_version(evdev);
+    joydev->vendor  = id.vendor;
+    joydev->product = id.product;
+    joydev->version = id.version;
 
-    scan_buttons(joydev, evdev);
-    scan_axes(joydev, evdev);
+    if (bit_is_set(types, EV_KEY)) {
+        scan_buttons(joydev, fd);
+    }
+    if (bit_is_set(types, EV_ABS)) {
+        scan_axes(joydev, fd);
+    }
     joydev->num_hats = 0;
 
     joydev->hwdata = hwdata_new();
 
-    libevdev_free(evdev);
-    close(fd);
+    if (probe_fd_timeout > 0) {
+        /* the device is likely to be opened right after enumeration */
+        hwdata_t *hwdata = joydev->hwdata;
+
+        hwdata->probe_fd   = fd;
+        hwdata->probe_time = joy_time_us();
+        __atomic_add_fetch(&probe_fds_open, 1, __ATOMIC_RELAXED);
+    } else {
+        close(fd);
+    }
     return joydev;
 }
 
 
+/** \brief  Sort event nodes by their number
+ *
+ * Sort "event2" before "event10", unlike \c alphasort().
+ *
+ * \param[in]   a   first directory entry
+ * \param[in]   b   second directory entry
+ *
+ * \return  <0, 0 or >0
+ */
+static int node_compare(const struct dirent **a, const struct dirent **b)
+{
+    const char *na = (*a)->d_name + NODE_PREFIX_LEN;
+    const char *nb = (*b)->d_name + NODE_PREFIX_LEN;
+    size_t      la = strlen(na);
+    size_t      lb = strlen(nb);
+
+    if (la != lb) {
+        return la < lb ? -1 : 1;
+    }
+    return strcmp(na, nb);
+}
+
+
+/** \brief  Outcome of probing a node */
+typedef enum probe_status_e {
+    PROBE_FAILED,       /**< node couldn't be opened or isn't an evdev device */
+    PROBE_SKIPPED,      /**< node isn't a joystick according to sysfs */
+    PROBE_CACHED,       /**< device taken from the device cache */
+    PROBE_OPENED        /**< device opened and probed */
+} probe_status_t;
+
+/** \brief  Work shared by the probe threads */
+typedef struct probe_work_s {
+    struct dirent  **namelist;  /**< event nodes */
+    joy_device_t   **results;   /**< device per node, \c NULL if unusable */
+    probe_status_t  *status;    /**< outcome per node */
+    bool             use_cache; /**< look up nodes in the device cache first */
+    bool             use_sysfs; /**< skip nodes that aren't joysticks */
+    int              count;     /**< number of nodes */
+    int              next;      /**< index of next node to probe */
+} probe_work_t;
+
+/** \brief  Probe thread
+ *
+ * Take nodes to probe from the shared work until all nodes are done.
+ *
+ * \param[in]   arg shared work
+ *
+ * \return  \c NULL
+ */
+static void *probe_thread(void *arg)
+{
+    probe_work_t *work = arg;
+    int           i;
+
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+        char         *node   = node_full_path(work->namelist[i]->d_name);
+        joy_device_t *joydev = NULL;
+
+        if (work->use_sysfs && !sysfs_is_joystick(node)) {
+            work->results[i] = NULL;
+            work->status[i]  = PROBE_SKIPPED;
+            lib_free(node);
+            continue;
+        }
+
+        if (work->use_cache) {
+            joydev = devcache_lookup(node);
+        }
+        if (joydev != NULL) {
+            joydev->hwdata  = hwdata_new();
+            work->status[i] = PROBE_CACHED;
+        } else {
+            joydev          = get_device_data(node);
+            work->status[i] = joydev != NULL ? PROBE_OPENED : PROBE_FAILED;
+            if (joydev == NULL && work->use_sysfs) {
+                /* sysfs is readable by anyone, the node often isn't */
+                char *name = sysfs_read(node, "name");
+
+                msg_verbose("%s (%s) looks like a joystick but can't be opened\n",
+                            node, name != NULL ? name : "unknown");
+                lib_free(name);
+            }
+        }
+        work->results[i] = joydev;
+        lib_free(node);
+    }
+    return NULL;
+}
+
+/** \brief  Determine number of threads to probe nodes with
+ *
+ * \param[in]   count   number of nodes
+ *
+ * \return  number of threads, including the calling thread
+ */
+static int probe_thread_count(int count)
+{
+    int n = probe_threads;
+
+    /* probing mostly waits on the kernel and the devices, so don't limit the
+     * default to the number of CPUs */
+    if (n <= 0 || n > PROBE_THREADS_MAX) {
+        n = PROBE_THREADS_MAX;
+    }
+    if (n > count) {
+        n = count;
+    }
+    return n < 1 ? 1 : n;
+}
+
+
 int joy_arch_device_list_init(joy_device_t ***devices)
 {
     struct dirent **namelist = NULL;
     joy_device_t  **joylist;
-    size_t          joylist_size;
     size_t          joylist_index;
+    probe_work_t    work;
+    pthread_t       threads[PROBE_THREADS_MAX];
+    int             num_threads;
+    int             started = 0;
+    int             cached  = 0;
+    int             skipped = 0;
+    char           *cache_path = NULL;
+    const char     *root;
+    bool            use_sysfs;
+    uint64_t        t_start;
     int             sr;     /* scandir result */
 
-    sr = scandir(NODE_ROOT, &namelist, node_filter, NULL);
+    t_start = joy_time_us();
+
+    /* Enumerate the event nodes through sysfs if available, so we only need
+     * to open the nodes of joysticks. Otherwise open all nodes in /dev/input
+     * to find out what they are. */
+    use_sysfs = sysfs_available();
+    root      = use_sysfs ? sysfs_input_root() : NODE_ROOT;
+    sr = scandir(root, &namelist, node_filter, node_compare);
     if (sr < 0) {
         fprintf(stderr, "%s(): scandir failed on %s: %s.\n",
-                __func__, NODE_ROOT, strerror(errno));
+                __func__, root, strerror(errno));
         return -1;
     }
+    msg_debug("enumerating event nodes through %s\n", root);
 
-    joylist_size  = DEVICES_INITIAL_SIZE;
-    joylist_index = 0;
-    joylist       = lib_malloc(joylist_size * sizeof *joylist);
+    if (!no_device_cache) {
+        cache_path = devcache_default_path();
+        if (cache_path != NULL) {
+            devcache_load(cache_path);
+        }
+    }
+
+    /* Opening and querying a node can be slow, so probe the nodes in
+     * parallel. Each node has its own slot in the results so the list ends
+     * up in node order regardless of which thread probed it. */
+    work.namelist = namelist;
+    work.results   = lib_malloc(((size_t)sr + 1u) * sizeof *work.results);
+    work.status    = lib_malloc(((size_t)sr + 1u) * sizeof *work.status);
+    work.use_cache = cache_path != NULL;
+    work.use_sysfs = use_sysfs;
+    work.count     = sr;
+    work.next      = 0;
+
+    num_threads = probe_thread_count(sr);
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[started], NULL, probe_thread, &work) != 0) {
+            msg_debug("failed to create probe thread, continuing with %d\n",
+                      started + 1);
+            break;
+        }
+        started++;
+    }
+    /* the calling thread helps out */
+    probe_thread(&work);
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
 
+    /* compact results into device list, reusing the results array */
+    joylist       = work.results;
+    joylist_index = 0;
     for (int i = 0; i < sr; i++) {
-        joy_device_t *dev;
-        char         *node;
+        joy_device_t *dev = work.results[i];
 
-        node = node_full_path(namelist[i]->d_name);
-        dev  = get_device_data(node);
+        if (work.status[i] == PROBE_SKIPPED) {
+            skipped++;
+        }
         if (dev != NULL) {
-            /* -1 for the terminating NULL */
-            if (joylist_index == joylist_size - 1u) {
-                joylist_size *= 2u;
-                joylist       = lib_realloc(joylist,
-                                            joylist_size * sizeof *joylist);
+            if (work.status[i] == PROBE_CACHED) {
+                cached++;
+            } else if (cache_path != NULL) {
+                devcache_store(dev);
             }
-#if 0
-            printf("node   : %s\n"
-                   "name   : \"%s\"\n"
-                   "vendor : %04"PRIx16"\n"
-                   "product: %04"PRIx16"\n"
-                   "buttons: %"PRIu32"\n"
-                   "axes   : %"PRIu32"\n",
-                dev->node,
-                   dev->name,
-                   dev->vendor,
-                dev->product,
-                   dev->num_buttons,
-                   dev->num_axes);
-#endif
             /* determine capabilities for emulated devices */
             joy_device_set_capabilities(dev);
+            if (dev->capabilities == JOY_CAPS_NONE) {
+                /* won't be opened for polling */
+                probe_fd_release(dev->hwdata);
+            }
             joylist[joylist_index++] = dev;
         }
-        lib_free(node);
         free(namelist[i]);
     }
     free(namelist);
+    lib_free(work.status);
+
+    if (cache_path != NULL) {
+        devcache_save(cache_path);
+        devcache_free();
+        lib_free(cache_path);
+    }
+
+    msg_verbose("probed %d nodes (%d skipped, %d devices from cache) in %"PRIu64" usec using %d thread%s\n",
+                sr, skipped, cached, joy_time_us() - t_start, started + 1,
+                started > 0 ? "s" : "");
 
     joylist[joylist_index] = NULL;
     *devices               = joylist;
+    /* enumeration can take longer than the timeout */
+    probe_fd_expire(joylist);
     return (int)joylist_index;
 }
 
@@ -350,8 +751,11 @@ int joy_arch_device_list_init(joy_device_t ***devices)
  *
  * Open the joystick device for polling.
  *
- * Associate a file descriptor and libevdev instance with the device through
- * its device node.
+ * Associate a file descriptor with the device through its device node, or
+ * reuse the one kept open after probing. Events are read from the descriptor
+ * directly, so no libevdev instance is created: \c libevdev_new_from_fd()
+ * would query the complete device state again, which was already obtained
+ * when probing.
  *
  * \param[in]   joydev  joystick device
  *
@@ -359,27 +763,34 @@ int joy_arch_device_list_init(joy_device_t ***devices)
  */
 static bool joydev_open(joy_device_t *joydev)
 {
-    hwdata_t       * hwdata;
-    struct libevdev *evdev;
-    int              fd;
-    int              rc;
+    hwdata_t  *hwdata;
+    clockid_t  clock = CLOCK_MONOTONIC;
+    int        fd;
 
-    fd = open(joydev->node, O_RDONLY|O_NONBLOCK);
+    hwdata = joydev->hwdata;
+    fd     = probe_fd_take(hwdata);
+    if (fd < 0) {
+        fd = open(joydev->node, O_RDONLY|O_NONBLOCK);
+    } else {
+        msg_debug("reusing probe fd %d for %s\n", fd, joydev->node);
+    }
     if (fd < 0) {
         fprintf(stderr, "failed to open %s: %s\n", joydev->node, strerror(errno));
         return false;
     }
 
-    rc = libevdev_new_from_fd(fd, &evdev);
-    if (rc < 0) {
-        fprintf(stderr, "failed to init libevdev: %s\n", strerror(-rc));
-        close(fd);
-        return false;
+    /* get event timestamps on the same clock as joy_time_us() */
+    if (ioctl(fd, EVIOCSCLOCKID, &clock) < 0) {
+        fprintf(stderr, "warning: failed to set event clock of %s: %s, "
+                "event latencies will be wrong\n", joydev->node, strerror(errno));
     }
 
-    hwdata        = joydev->hwdata;
-    hwdata->evdev = evdev;
-    hwdata->fd    = fd;
+    hwdata->fd         = fd;
+    hwdata->lost       = false;
+    hwdata->dropped     = false;
+    hwdata->num_reads   = 0;
+    hwdata->num_events  = 0;
+    hwdata->frame_count = 0;
     return true;
 }
 
@@ -387,7 +798,7 @@ static bool joydev_open(joy_device_t *joydev)
  *
  * Close the device.
  *
- * Close the file descriptor and free the libdevdev instance.
+ * Close the file descriptor.
  *
  * \param[in]   joydev  joystick device
  */
@@ -397,20 +808,66 @@ static void joydev_close(joy_device_t *joydev)
 
     if (hwdata != NULL) {
         if (hwdata->fd >= 0) {
+            uint64_t reads  = __atomic_load_n(&hwdata->num_reads, __ATOMIC_RELAXED);
+            uint64_t events = __atomic_load_n(&hwdata->num_events, __ATOMIC_RELAXED);
+
+            if (reads > 0) {
+                msg_verbose("%s: read %"PRIu64" events with %"PRIu64" read() calls"
+                            " (%.2f syscalls per event)\n",
+                            joydev->node, events, reads,
+                            events > 0 ? (double)reads / (double)events : 0.0);
+            }
             close(hwdata->fd);
             hwdata->fd = -1;
         }
-        if (hwdata->evdev != NULL) {
-            libevdev_free(hwdata->evdev);
-            hwdata->evdev = NULL;
-        }
     }
 }
 
-static void poll_dispatch_event(joy_device_t *joydev, struct input_event *event)
+/** \brief  Get time of event on the \c joy_time_us() clock
+ *
+ * \param[in]   event   event
+ *
+ * \return  time of event in microseconds
+ */
+static inline uint64_t event_timestamp(const struct input_event *event)
+{
+    return (uint64_t)event->input_event_sec * 1000000u +
+           (uint64_t)event->input_event_usec;
+}
+
+/** \brief  Record event as read from the device
+ *
+ * Records every axis and button event, before the events of a frame are
+ * combined and before axis values are converted, so a recording holds what
+ * the device reported.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   event   event
+ */
+static void poll_record_event(joy_device_t *joydev, const struct input_event *event)
+{
+    if (event->type == EV_KEY && IS_BUTTON(event->code)) {
+        joy_record_event(joydev, JOY_INPUT_BUTTON, event->code, event->value,
+                         event_timestamp(event));
+    } else if (event->type == EV_ABS && IS_AXIS(event->code)) {
+        joy_record_event(joydev, JOY_INPUT_AXIS, event->code, event->value,
+                         event_timestamp(event));
+    }
+}
+
+/** \brief  Add event to the batch of events of the current poll
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   batch   event batch
+ * \param[in]   event   evdev event
+ */
+static void poll_dispatch_event(joy_device_t       *joydev,
+                                joy_event_batch_t  *batch,
+                                struct input_event *event)
 {
     joy_axis_t            *axis;
     joystick_axis_value_t  axis_value;
+    uint64_t               timestamp;
 
     if (event->type == EV_SYN) {
         msg_verbose("event: time %ld.%06ld: %s\n",
@@ -427,27 +884,192 @@ static void poll_dispatch_event(joy_device_t *joydev, struct input_event *event)
                     libevdev_event_code_get_name(event->type, event->code),
                     event->value);
 
+        timestamp = event_timestamp(event);
+
         if (event->type == EV_KEY && IS_BUTTON(event->code)) {
-            joy_button_event(joydev,
-                             joy_button_from_code(joydev, event->code),
-                             event->value);
+            joy_event_batch_button(batch,
+                                   joy_button_from_code(joydev, event->code),
+                                   event->value,
+                                   timestamp);
         } else if (event->type == EV_ABS && IS_AXIS(event->code)) {
             /* TODO: configurable threshold/deadzone */
-            axis       = joy_axis_from_code(joydev, event->code);
-            axis_value = joy_axis_value_from_hwdata(axis, event->value);
-            joy_axis_event(joydev, axis, axis_value);
+            axis = joy_axis_from_code(joydev, event->code);
+            if (axis != NULL) {
+                axis_value = joy_axis_value_from_hwdata(axis, event->value);
+                joy_event_batch_axis(batch, axis, axis_value, timestamp);
+            }
         }
     }
 }
 
+/** \brief  Submit frame of events
+ *
+ * Dispatch the final value of each axis and button that changed in the
+ * current frame and submit them together.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   batch   event batch
+ */
+static void frame_submit(joy_device_t *joydev, joy_event_batch_t *batch)
+{
+    hwdata_t *hwdata = joydev->hwdata;
+
+    for (uint32_t i = 0; i < hwdata->frame_count; i++) {
+        poll_dispatch_event(joydev, batch, &(hwdata->frame[i]));
+    }
+    hwdata->frame_count = 0;
+    joy_event_batch_flush(batch);
+}
+
+/** \brief  Add event to current frame
+ *
+ * Replaces the value of an earlier event for the same axis or button in the
+ * frame, so only the final value gets dispatched.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   batch   event batch
+ * \param[in]   event   event
+ */
+static void frame_add(joy_device_t             *joydev,
+                      joy_event_batch_t        *batch,
+                      const struct input_event *event)
+{
+    hwdata_t *hwdata = joydev->hwdata;
+    uint32_t  i;
+
+    for (i = 0; i < hwdata->frame_count; i++) {
+        if (hwdata->frame[i].code == event->code && hwdata->frame[i].type == event->type) {
+            hwdata->frame[i] = *event;
+            return;
+        }
+    }
+    if (hwdata->frame_count == FRAME_MAX_EVENTS) {
+        frame_submit(joydev, batch);
+    }
+    hwdata->frame[hwdata->frame_count++] = *event;
+}
+
+/** \brief  Resynchronize device state after the kernel dropped events
+ *
+ * Query the state of all buttons with a single \c EVIOCGKEY and the value of
+ * each axis with \c EVIOCGABS, and submit events only for the inputs whose
+ * state differs from the last state we dispatched. Inputs that events are
+ * never dispatched for are skipped.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   batch   event batch
+ */
+static void poll_resync(joy_device_t *joydev, joy_event_batch_t *batch)
+{
+    hwdata_t      *hwdata  = joydev->hwdata;
+    unsigned long  keys[BITS_TO_LONGS(KEY_CNT)];
+    uint64_t       now     = joy_time_us();
+    uint32_t       changes = 0;
+
+    msg_debug("=== DROPPED ===\n");
+
+    if (joydev->num_buttons == 0) {
+        /* NOP */
+    } else if (ioctl(hwdata->fd, EVIOCGKEY(sizeof keys), keys) < 0) {
+        msg_debug("EVIOCGKEY failed: %s\n", strerror(errno));
+    } else {
+        for (uint32_t b = 0; b < joydev->num_buttons; b++) {
+            joy_button_t *button = &(joydev->buttons[b]);
+            int32_t       value;
+
+            /* same filter as poll_dispatch_event() */
+            if (!IS_BUTTON(button->code)) {
+                continue;
+            }
+            value = bit_is_set(keys, button->code) ? 1 : 0;
+            if (value != (button->prev != 0 ? 1 : 0)) {
+                joy_record_event(joydev, JOY_INPUT_BUTTON, button->code, value, now);
+                joy_event_batch_button(batch, button, value, now);
+                changes++;
+            }
+        }
+    }
+
+    for (uint32_t a = 0; a < joydev->num_axes; a++) {
+        joy_axis_t            *axis = &(joydev->axes[a]);
+        struct input_absinfo   absinfo;
+        joystick_axis_value_t  value;
+
+        if (!IS_AXIS(axis->code)) {
+            continue;
+        }
+        if (ioctl(hwdata->fd, EVIOCGABS((unsigned int)axis->code), &absinfo) < 0) {
+            msg_debug("EVIOCGABS(%02x) failed: %s\n", axis->code, strerror(errno));
+            continue;
+        }
+        value = joy_axis_value_from_hwdata(axis, absinfo.value);
+        if ((int32_t)value != axis->prev) {
+            joy_record_event(joydev, JOY_INPUT_AXIS, axis->code, absinfo.value, now);
+            joy_event_batch_axis(batch, axis, value, now);
+            changes++;
+        }
+    }
+
+    joy_event_batch_flush(batch);
+    msg_debug("=== RESYNCED: %"PRIu32" changes ===\n", changes);
+}
+
+/** \brief  Handle events read from device
+ *
+ * Axis and button events are collected until the \c SYN_REPORT that ends the
+ * frame, which may arrive in a later read, then the frame is submitted.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   batch   event batch
+ * \param[in]   count   number of events in the device's read buffer
+ */
+static void poll_handle_events(joy_device_t      *joydev,
+                               joy_event_batch_t *batch,
+                               size_t             count)
+{
+    hwdata_t *hwdata = joydev->hwdata;
+
+    for (size_t i = 0; i < count; i++) {
+        struct input_event *event = &(hwdata->events[i]);
+
+        if (event->type == EV_SYN) {
+            if (event->code == SYN_DROPPED) {
+                /* the frame is incomplete, the state is obtained on resync */
+                hwdata->dropped     = true;
+                hwdata->frame_count = 0;
+            } else if (event->code == SYN_REPORT) {
+                if (hwdata->dropped) {
+                    hwdata->dropped = false;
+                    poll_resync(joydev, batch);
+                } else {
+                    frame_submit(joydev, batch);
+                }
+            }
+        } else if (hwdata->dropped) {
+            continue;
+        } else if (event->type == EV_ABS || event->type == EV_KEY) {
+            poll_record_event(joydev, event);
+            frame_add(joydev, batch, event);
+        }
+    }
+}
+
+/** \brief  Driver \c poll method
+ *
+ * Read all pending events from the device, up to \c READ_MAX_EVENTS per
+ * \c read() call, and dispatch them a frame at a time.
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c false if the device couldn't be read, for example because it
+ *          was unplugged
+ */
 static bool joydev_poll(joy_device_t *joydev)
 {
-    hwdata_t           *hwdata;
-    struct libevdev    *evdev;
-    struct input_event  event;
-    unsigned int        flags = LIBEVDEV_READ_FLAG_NORMAL;
-    int                 fd;
-    int                 rc;
+    hwdata_t          *hwdata;
+    joy_event_batch_t  batch;
+    ssize_t            len;
+    bool               result = true;
 
     if (joydev == NULL || joydev->hwdata == NULL) {
         /* nothing to poll */
@@ -455,40 +1077,457 @@ static bool joydev_poll(joy_device_t *joydev)
     }
 
     hwdata = joydev->hwdata;
-    evdev  = hwdata->evdev;
-    fd     = hwdata->fd;
-    if (evdev == NULL || fd < 0) {
-        fprintf(stderr, "%s(): evdev is NULL or fd invalid\n", __func__);
+    if (hwdata->fd < 0) {
+        fprintf(stderr, "%s(): fd invalid\n", __func__);
         return false;
     }
 
-    while (libevdev_has_event_pending(evdev)) {
-        rc = libevdev_next_event(evdev, flags, &event);
-        if (rc == LIBEVDEV_READ_STATUS_SYNC) {
-            msg_debug("=== DROPPED ===\n");
-            while (rc == LIBEVDEV_READ_STATUS_SYNC) {
-                msg_debug("=== SYNCING ===\n");
-                rc = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &event);
+    /* frame_submit() flushes the batch on every SYN_REPORT */
+    joy_event_batch_init(&batch, joydev, true);
+    do {
+        size_t count;
+
+        len = read(hwdata->fd, hwdata->events, sizeof hwdata->events);
+        __atomic_store_n(&hwdata->num_reads, hwdata->num_reads + 1u, __ATOMIC_RELAXED);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                /* device unplugged (ENODEV) or other read error */
+                msg_error("failed to read event from %s: %s\n",
+                          joydev->node, strerror(errno));
+                result = false;
+            }
+            break;
+        } else if (len == 0) {
+            msg_error("failed to read event from %s: end of file\n", joydev->node);
+            result = false;
+            break;
+        }
+
+        count = (size_t)len / sizeof hwdata->events[0];
+        __atomic_store_n(&hwdata->num_events, hwdata->num_events + count, __ATOMIC_RELAXED);
+        poll_handle_events(joydev, &batch, count);
+        /* a short read means we've emptied the kernel's buffer, don't spend
+         * another syscall only to get EAGAIN */
+    } while (len < 0 || (size_t)len == sizeof hwdata->events);
+    joy_event_batch_flush(&batch);
+
+    return result;
+}
+
+
+/** \brief  Input thread state */
+static struct {
+    pthread_t      thread;      /**< thread ID */
+    int            epoll_fd;    /**< epoll instance */
+    int            stop_fd;     /**< eventfd used to wake up the thread */
+    joy_device_t **devices;     /**< devices polled */
+    size_t         count;       /**< number of devices polled */
+    bool           started;     /**< thread was started */
+    bool           active;      /**< thread is polling devices */
+} input_thread = {
+    .epoll_fd = -1,
+    .stop_fd  = -1
+};
+
+/** \brief  Input thread
+ *
+ * Block until any of the devices has events, or until we're asked to stop,
+ * and poll each device that has events. Devices that fail to poll, for
+ * example because they were unplugged, are no longer polled and flagged as
+ * lost, the caller closes them after checking \c input_thread_lost(). The
+ * thread keeps running without devices, so devices plugged in later can be
+ * added with \c input_thread_add().
+ *
+ * \param[in]   arg unused
+ *
+ * \return  \c NULL
+ */
+static void *input_thread_main(void *arg)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    bool               stop = false;
+
+    (void)arg;
+
+    while (!stop) {
+        int nfds = epoll_wait(input_thread.epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+
+        if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            msg_error("epoll_wait() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            joy_device_t *joydev = events[i].data.ptr;
+
+            if (joydev == NULL) {
+                /* woken up by input_thread_stop() */
+                stop = true;
+                break;
             }
-            msg_debug("=== RESYNCED ===\n");
-        } else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-            if (event.type == EV_ABS || event.type == EV_KEY) {
-                poll_dispatch_event(joydev, &event);
+            if ((events[i].events & (EPOLLERR|EPOLLHUP)) || !joydev_poll(joydev)) {
+                hwdata_t *hwdata = joydev->hwdata;
+
+                msg_error("lost device %s, no longer polling it\n", joydev->node);
+                epoll_ctl(input_thread.epoll_fd, EPOLL_CTL_DEL, hwdata->fd, NULL);
+                /* the fd can be closed once the flag is seen */
+                __atomic_store_n(&hwdata->lost, true, __ATOMIC_RELEASE);
             }
         }
     }
 
+    __atomic_store_n(&input_thread.active, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/** \brief  Close file descriptors of the input thread */
+static void input_thread_close_fds(void)
+{
+    if (input_thread.epoll_fd >= 0) {
+        close(input_thread.epoll_fd);
+        input_thread.epoll_fd = -1;
+    }
+    if (input_thread.stop_fd >= 0) {
+        close(input_thread.stop_fd);
+        input_thread.stop_fd = -1;
+    }
+}
+
+/** \brief  Driver \c thread_start method
+ *
+ * Register the file descriptors of all \a devices with an epoll instance and
+ * start a thread that waits for and polls them.
+ *
+ * \param[in]   devices list of opened devices
+ * \param[in]   count   number of devices in \a devices
+ *
+ * \return  \c true on success
+ */
+static bool input_thread_start(joy_device_t **devices, size_t count)
+{
+    struct epoll_event ev;
+    int                rc;
+
+    if (input_thread.started) {
+        msg_error("input thread already running\n");
+        return false;
+    }
+
+    input_thread.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (input_thread.epoll_fd < 0) {
+        msg_error("epoll_create1() failed: %s\n", strerror(errno));
+        return false;
+    }
+    input_thread.stop_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if (input_thread.stop_fd < 0) {
+        msg_error("eventfd() failed: %s\n", strerror(errno));
+        input_thread_close_fds();
+        return false;
+    }
+
+    /* the stop event is recognized by its NULL pointer */
+    ev.events   = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(input_thread.epoll_fd, EPOLL_CTL_ADD, input_thread.stop_fd, &ev);
+
+    for (size_t i = 0; i < count; i++) {
+        hwdata_t *hwdata = devices[i]->hwdata;
+
+        if (hwdata == NULL || hwdata->fd < 0) {
+            msg_error("device %s isn't opened\n", devices[i]->node);
+            input_thread_close_fds();
+            return false;
+        }
+        ev.events   = EPOLLIN;
+        ev.data.ptr = devices[i];
+        if (epoll_ctl(input_thread.epoll_fd, EPOLL_CTL_ADD, hwdata->fd, &ev) < 0) {
+            msg_error("epoll_ctl() failed for %s: %s\n",
+                      devices[i]->node, strerror(errno));
+            input_thread_close_fds();
+            return false;
+        }
+    }
+
+    input_thread.devices   = devices;
+    input_thread.count     = count;
+    input_thread.active    = true;
+    rc = pthread_create(&input_thread.thread, NULL, input_thread_main, NULL);
+    if (rc != 0) {
+        msg_error("pthread_create() failed: %s\n", strerror(rc));
+        input_thread.active = false;
+        input_thread_close_fds();
+        return false;
+    }
+    input_thread.started = true;
+    return true;
+}
+
+/** \brief  Driver \c thread_stop method
+ *
+ * Wake up the input thread, wait for it to exit and clean up.
+ */
+static void input_thread_stop(void)
+{
+    uint64_t one = 1;
+
+    if (!input_thread.started) {
+        return;
+    }
+    if (write(input_thread.stop_fd, &one, sizeof one) < 0) {
+        msg_error("failed to wake up input thread: %s\n", strerror(errno));
+    }
+    pthread_join(input_thread.thread, NULL);
+    input_thread_close_fds();
+    input_thread.started = false;
+    input_thread.devices = NULL;
+    input_thread.count   = 0;
+}
+
+/** \brief  Driver \c thread_active method
+ *
+ * \return  \c true if the input thread is still polling devices
+ */
+static bool input_thread_active(void)
+{
+    return __atomic_load_n(&input_thread.active, __ATOMIC_ACQUIRE);
+}
+
+/** \brief  Driver \c thread_add method
+ *
+ * Add a device, for example one that was just plugged in, to the devices
+ * polled by the running input thread.
+ *
+ * \param[in]   joydev  opened joystick device
+ *
+ * \return  \c true on success
+ */
+static bool input_thread_add(joy_device_t *joydev)
+{
+    hwdata_t           *hwdata = joydev->hwdata;
+    struct epoll_event  ev;
+
+    if (!input_thread_active() || hwdata == NULL || hwdata->fd < 0) {
+        return false;
+    }
+    ev.events   = EPOLLIN;
+    ev.data.ptr = joydev;
+    if (epoll_ctl(input_thread.epoll_fd, EPOLL_CTL_ADD, hwdata->fd, &ev) < 0) {
+        msg_error("epoll_ctl() failed for %s: %s\n", joydev->node, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/** \brief  Driver \c thread_lost method
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c true if the input thread stopped polling \a joydev because it
+ *          failed, the device can then be closed
+ */
+static bool input_thread_lost(joy_device_t *joydev)
+{
+    hwdata_t *hwdata = joydev->hwdata;
+
+    return hwdata != NULL && __atomic_load_n(&hwdata->lost, __ATOMIC_ACQUIRE);
+}
+
+
+/** \brief  File descriptor of the inotify instance watching \c NODE_ROOT */
+static int hotplug_fd = -1;
+
+/** \brief  Driver \c hotplug_start method
+ *
+ * Watch \c NODE_ROOT for event nodes being created or removed.
+ *
+ * \return  \c true on success
+ */
+static bool hotplug_start(void)
+{
+    if (hotplug_fd >= 0) {
+        return true;
+    }
+    hotplug_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (hotplug_fd < 0) {
+        msg_error("inotify_init1() failed: %s\n", strerror(errno));
+        return false;
+    }
+    /* udev creates the node before setting its permissions, so we also
+     * need IN_ATTRIB to be able to open a new node */
+    if (inotify_add_watch(hotplug_fd, NODE_ROOT, IN_CREATE|IN_ATTRIB|IN_DELETE) < 0) {
+        msg_error("inotify_add_watch() failed on %s: %s\n", NODE_ROOT, strerror(errno));
+        close(hotplug_fd);
+        hotplug_fd = -1;
+        return false;
+    }
     return true;
 }
 
+/** \brief  Driver \c hotplug_stop method */
+static void hotplug_stop(void)
+{
+    if (hotplug_fd >= 0) {
+        close(hotplug_fd);
+        hotplug_fd = -1;
+    }
+}
+
+/** \brief  Probe new event node and add it to the device list
+ *
+ * \param[in,out]   devices     device list
+ * \param[in]       node        path to device node
+ * \param[in]       callback    function to call for the added device
+ */
+static void hotplug_add_node(joy_device_t       ***devices,
+                             const char          *node,
+                             joy_hotplug_func_t   callback)
+{
+    joy_device_t *joydev;
+
+    if (sysfs_available() && !sysfs_is_joystick(node)) {
+        msg_debug("node %s isn't a joystick -- ignoring\n", node);
+        return;
+    }
+    joydev = get_device_data(node);
+    if (joydev != NULL) {
+        msg_debug("node %s added\n", node);
+        joy_device_list_add(devices, joydev);
+        if (callback != NULL) {
+            callback(joydev, true);
+        }
+        /* not opened by the callback, don't keep the node open */
+        probe_fd_release(joydev->hwdata);
+    }
+}
+
+/** \brief  Handle inotify event for node in \c NODE_ROOT
+ *
+ * \param[in,out]   devices     device list
+ * \param[in]       event       inotify event
+ * \param[in]       callback    function to call for added devices
+ */
+static void hotplug_handle_event(joy_device_t             ***devices,
+                                 const struct inotify_event  *event,
+                                 joy_hotplug_func_t           callback)
+{
+    joy_device_t *joydev;
+    char         *node;
+
+    if (event->len == 0 ||
+            strncmp(event->name, NODE_PREFIX, NODE_PREFIX_LEN) != 0 ||
+            event->name[NODE_PREFIX_LEN] == '\0') {
+        return;
+    }
+
+    node   = node_full_path(event->name);
+    joydev = joy_device_get(*devices, node);
+    if (event->mask & IN_DELETE) {
+        if (joydev != NULL) {
+            /* removed from the list once closed */
+            hwdata_t *hwdata = joydev->hwdata;
+
+            msg_debug("node %s removed\n", node);
+            hwdata->unplugged = true;
+            hwdata->replugged = false;
+        }
+    } else if (joydev == NULL) {
+        /* new node, or permissions of a node we couldn't open changed */
+        hotplug_add_node(devices, node, callback);
+    } else if (((hwdata_t *)joydev->hwdata)->unplugged) {
+        /* node reused before the unplugged device was removed from the list:
+         * probe the new node once the old device is gone */
+        msg_debug("node %s replugged\n", node);
+        ((hwdata_t *)joydev->hwdata)->replugged = true;
+    }
+    lib_free(node);
+}
+
+/** \brief  Driver \c hotplug_poll method
+ *
+ * Read pending inotify events without blocking and add devices for new event
+ * nodes. Devices whose node was removed are removed from the list once they
+ * are closed, and a new node created with the same name in the meantime is
+ * probed right after.
+ *
+ * \param[in,out]   devices     device list
+ * \param[in]       callback    function to call for added and removed devices
+ *
+ * \return  number of devices in \a devices, or -1 on error
+ */
+static int hotplug_poll(joy_device_t ***devices, joy_hotplug_func_t callback)
+{
+    /* aligned for struct inotify_event */
+    char    buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    size_t  i;
+
+    if (hotplug_fd < 0) {
+        return -1;
+    }
+
+    while ((len = read(hotplug_fd, buffer, sizeof buffer)) > 0) {
+        const char *ptr = buffer;
+
+        while (ptr < buffer + len) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+            hotplug_handle_event(devices, event, callback);
+            ptr += sizeof *event + event->len;
+        }
+    }
+    if (len < 0 && errno != EAGAIN) {
+        msg_error("failed to read inotify events: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* remove closed devices that were unplugged */
+    i = 0;
+    while (*devices != NULL && (*devices)[i] != NULL) {
+        joy_device_t *joydev = (*devices)[i];
+        hwdata_t     *hwdata = joydev->hwdata;
+
+        if (hwdata->unplugged && hwdata->fd < 0) {
+            char *node = hwdata->replugged ? lib_strdup(joydev->node) : NULL;
+
+            if (callback != NULL) {
+                callback(joydev, false);
+            }
+            joy_device_list_remove(devices, joydev);
+            if (node != NULL) {
+                /* appended to the list, checked later in this loop */
+                hotplug_add_node(devices, node, callback);
+                lib_free(node);
+            }
+        } else {
+            i++;
+        }
+    }
+    return (int)i;
+}
+
 
 bool joy_arch_init(void)
 {
     joy_driver_t driver = {
-        .open        = joydev_open,
-        .close       = joydev_close,
-        .poll        = joydev_poll,
-        .hwdata_free = hwdata_free
+        .open          = joydev_open,
+        .close         = joydev_close,
+        .poll          = joydev_poll,
+        .hwdata_free   = hwdata_free,
+        .thread_start  = input_thread_start,
+        .thread_stop   = input_thread_stop,
+        .thread_active = input_thread_active,
+        .thread_add    = input_thread_add,
+        .thread_lost   = input_thread_lost,
+        .hotplug_start = hotplug_start,
+        .hotplug_stop  = hotplug_stop,
+        .hotplug_poll  = hotplug_poll,
+        .idle          = probe_fd_expire
     };
 
     joy_driver_register(&driver);
@@ -498,7 +1537,8 @@ bool joy_arch_init(void)
 
 void joy_arch_shutdown(void)
 {
-    /* NOP for now */
+    input_thread_stop();
+    hotplug_stop();
 }
 
 
@@ -0,0 +1,232 @@
+/** \file   sysfs.c
+ * \brief   Linux input device information from sysfs
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * The kernel exposes the name, IDs and capability bitmaps of every input
+ * device in sysfs, readable by any user. This allows classifying event nodes
+ * without opening them, skipping the keyboards, mice, power buttons and lid
+ * switches that make up most of \c /dev/input.
+ *
+ * The directory with the input class devices defaults to \c /sys/class/input
+ * and can be changed with \c --sysfs-root, so fixture trees can be used for
+ * testing and benchmarking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/input.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "lib.h"
+#include "evbits.h"
+
+#include "sysfs.h"
+
+
+/* directory with input class devices (--sysfs-root, NULL = default) */
+extern char *sysfs_root;
+
+
+/** \brief  Maximum length of an attribute value
+ *
+ * The largest value we read is the EV_KEY capability bitmap: 768 bits, which
+ * takes up to 216 characters on 32-bit and 204 characters on 64-bit hosts.
+ */
+#define ATTR_MAX_LEN    512
+
+/** \brief  Input property of accelerometers (motion sensors of gamepads) */
+#ifndef INPUT_PROP_ACCELEROMETER
+#define INPUT_PROP_ACCELEROMETER    0x06
+#endif
+
+
+/** \brief  Read first line of attribute of input device
+ *
+ * \param[in]   node    event node, only its basename is used
+ * \param[in]   attr    attribute path relative to the input device
+ * \param[out]  buffer  destination of value, without trailing whitespace
+ * \param[in]   size    size of \a buffer
+ *
+ * \return  \c false if the attribute couldn't be read
+ */
+static bool read_attr(const char *node, const char *attr, char *buffer, size_t size)
+{
+    char *path;
+    FILE *fp;
+    bool  result = false;
+
+    path = lib_msprintf("%s/%s/device/%s", sysfs_input_root(), lib_basename(node), attr);
+    fp   = fopen(path, "r");
+    if (fp != NULL) {
+        if (fgets(buffer, (int)size, fp) != NULL) {
+            lib_strrtrim(buffer);
+            result = true;
+        }
+        fclose(fp);
+    }
+    lib_free(path);
+    return result;
+}
+
+
+/** \brief  Get directory with input class devices
+ *
+ * \return  value of \c --sysfs-root or \c SYSFS_INPUT_ROOT
+ */
+const char *sysfs_input_root(void)
+{
+    return sysfs_root != NULL ? sysfs_root : SYSFS_INPUT_ROOT;
+}
+
+/** \brief  Test if the input class devices can be found in sysfs
+ *
+ * \return  \c true if the sysfs root is a directory
+ */
+bool sysfs_available(void)
+{
+    struct stat st;
+
+    return stat(sysfs_input_root(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/** \brief  Read first line of sysfs attribute
+ *
+ * \param[in]   node    event node, only its basename is used
+ * \param[in]   attr    attribute path relative to the input device
+ *
+ * \return  heap-allocated value without trailing whitespace, or \c NULL
+ */
+char *sysfs_read(const char *node, const char *attr)
+{
+    char buffer[ATTR_MAX_LEN];
+
+    if (!read_attr(node, attr, buffer, sizeof buffer)) {
+        return NULL;
+    }
+    return lib_strdup(buffer);
+}
+
+/** \brief  Read hexadecimal ID from sysfs
+ *
+ * \param[in]   node    event node, only its basename is used
+ * \param[in]   attr    attribute path relative to the input device
+ *
+ * \return  ID or 0 when not available
+ */
+uint16_t sysfs_read_id(const char *node, const char *attr)
+{
+    char buffer[ATTR_MAX_LEN];
+
+    if (!read_attr(node, attr, buffer, sizeof buffer)) {
+        return 0;
+    }
+    return (uint16_t)strtoul(buffer, NULL, 16);
+}
+
+/** \brief  Read capability bitmap from sysfs
+ *
+ * The bitmap is stored as space-separated hexadecimal longs with the most
+ * significant long first, and leading zero longs omitted.
+ *
+ * \param[in]   node    event node, only its basename is used
+ * \param[in]   attr    attribute path relative to the input device
+ * \param[out]  bits    bitmap
+ * \param[in]   nlongs  number of longs in \a bits
+ *
+ * \return  \c false if the attribute couldn't be read
+ */
+bool sysfs_read_bits(const char *node, const char *attr,
+                     unsigned long *bits, size_t nlongs)
+{
+    char   buffer[ATTR_MAX_LEN];
+    char  *words[ATTR_MAX_LEN / 2];
+    size_t count = 0;
+    char  *s;
+
+    memset(bits, 0, nlongs * sizeof *bits);
+    if (!read_attr(node, attr, buffer, sizeof buffer)) {
+        return false;
+    }
+
+    /* split into words, most significant first */
+    s = buffer;
+    while (*s != '\0' && count < ARRAY_LEN(words)) {
+        while (*s == ' ') {
+            s++;
+        }
+        if (*s == '\0') {
+            break;
+        }
+        words[count++] = s;
+        while (*s != '\0' && *s != ' ') {
+            s++;
+        }
+        if (*s == ' ') {
+            *s++ = '\0';
+        }
+    }
+
+    for (size_t i = 0; i < count && i < nlongs; i++) {
+        bits[i] = strtoul(words[count - 1u - i], NULL, 16);
+    }
+    return true;
+}
+
+/** \brief  Determine if input device looks like a joystick or gamepad
+ *
+ * Loosely follows udev's input_id builtin: a device with joystick or gamepad
+ * buttons, or with absolute X and Y axes that don't belong to a mouse,
+ * touchpad, touchscreen or tablet. Motion sensors of gamepads, which show up
+ * as separate devices with only axes, are rejected.
+ *
+ * \param[in]   node    event node, only its basename is used
+ *
+ * \return  \c true if joystick-like
+ */
+bool sysfs_is_joystick(const char *node)
+{
+    unsigned long ev[BITS_TO_LONGS(EV_CNT)];
+    unsigned long key[BITS_TO_LONGS(KEY_CNT)];
+    unsigned long abs[BITS_TO_LONGS(ABS_CNT)];
+    unsigned long prop[BITS_TO_LONGS(INPUT_PROP_CNT)];
+    unsigned int  code;
+
+    if (!sysfs_read_bits(node, "capabilities/ev", ev, ARRAY_LEN(ev))) {
+        return false;
+    }
+    if (!bit_is_set(ev, EV_KEY) && !bit_is_set(ev, EV_ABS)) {
+        return false;
+    }
+    sysfs_read_bits(node, "capabilities/key", key, ARRAY_LEN(key));
+    sysfs_read_bits(node, "capabilities/abs", abs, ARRAY_LEN(abs));
+    sysfs_read_bits(node, "properties", prop, ARRAY_LEN(prop));
+
+    if (bit_is_set(prop, INPUT_PROP_ACCELEROMETER)) {
+        return false;
+    }
+
+    for (code = BTN_JOYSTICK; code <= BTN_THUMBR; code++) {
+        if (bit_is_set(key, code)) {
+            return true;
+        }
+    }
+    for (code = BTN_TRIGGER_HAPPY; code <= BTN_TRIGGER_HAPPY40; code++) {
+        if (bit_is_set(key, code)) {
+            return true;
+        }
+    }
+
+    return bit_is_set(abs, ABS_X) &&
+           bit_is_set(abs, ABS_Y) &&
+           !bit_is_set(key, BTN_LEFT) &&
+           !bit_is_set(key, BTN_TOUCH) &&
+           !bit_is_set(key, BTN_TOOL_PEN) &&
+           !bit_is_set(key, BTN_TOOL_FINGER) &&
+           !bit_is_set(prop, INPUT_PROP_DIRECT) &&
+           !bit_is_set(prop, INPUT_PROP_POINTER);
+}
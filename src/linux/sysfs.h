@@ -0,0 +1,24 @@
+/** \file   sysfs.h
+ * \brief   Linux input device information from sysfs - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef VICE_SYSFS_H
+#define VICE_SYSFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \brief  Default directory with input class devices in sysfs */
+#define SYSFS_INPUT_ROOT    "/sys/class/input"
+
+const char *sysfs_input_root (void);
+bool        sysfs_available  (void);
+char       *sysfs_read       (const char *node, const char *attr);
+uint16_t    sysfs_read_id    (const char *node, const char *attr);
+bool        sysfs_read_bits  (const char *node, const char *attr,
+                              unsigned long *bits, size_t nlongs);
+bool        sysfs_is_joystick(const char *node);
+
+#endif
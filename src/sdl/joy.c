@@ -11,6 +11,7 @@
 #include <limits.h>
 
 #include "joyapi.h"
+#include "joyrecord.h"
 #include "lib.h"
 
 /* external symbols */
@@ -22,6 +23,8 @@ typedef struct hwdata_s {
     SDL_Joystick   *dev;    /**< SDL joystick handle */
     SDL_JoystickID  id;     /**< SDL joystick instance ID */
     int             index;  /**< index used for SDL_JoystickOpen() */
+    bool            failed; /**< device was removed or reported an invalid
+                                 input, stop polling it */
 } hwdata_t;
 
 
@@ -32,6 +35,16 @@ typedef struct hwdata_s {
  */
 static bool sdl_initialized = false;
 
+/** \brief  Devices opened for polling
+ *
+ * SDL has a single event queue for all joysticks, so events read while polling
+ * one device are routed to the device they belong to by instance ID.
+ */
+static joy_device_t **opened_devices = NULL;
+
+/** \brief  Number of elements in \c opened_devices */
+static size_t num_opened_devices = 0;
+
 
 /** \brief  Allocate SDL-specific data for joystick devices
  *
@@ -44,6 +57,7 @@ static hwdata_t *hwdata_new(void)
     hwdata->dev    = NULL;
     hwdata->id     = 0;
     hwdata->index  = -1;
+    hwdata->failed = false;
     return hwdata;
 }
 
@@ -65,6 +79,36 @@ static void hwdata_free(void *hwdata)
     }
 }
 
+/** \brief  Get opened device by SDL instance ID
+ *
+ * \param[in]   id  SDL joystick instance ID
+ *
+ * \return  device or \c NULL when no opened device has instance ID \a id,
+ *          or when polling the device failed
+ */
+static joy_device_t *device_from_instance_id(SDL_JoystickID id)
+{
+    for (size_t i = 0; i < num_opened_devices; i++) {
+        hwdata_t *hwdata = opened_devices[i]->hwdata;
+
+        if (hwdata->id == id && !hwdata->failed) {
+            return opened_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/** \brief  Stop polling device
+ *
+ * \param[in]   joydev  joystick device
+ */
+static void device_set_failed(joy_device_t *joydev)
+{
+    hwdata_t *hwdata = joydev->hwdata;
+
+    hwdata->failed = true;
+}
+
 /** \brief  Translate SDL hat direction to VICE hat direction
  *
  * \param[in]   value   SDL hat direction
@@ -119,6 +163,7 @@ static bool scan_axes(joy_device_t *joydev, SDL_Joystick *sdldev)
         axis->name = lib_msprintf("Axis_%d", a);
         axis->minimum = SDL_JOYSTICK_AXIS_MIN;
         axis->maximum = SDL_JOYSTICK_AXIS_MAX;
+        joy_axis_auto_calibrate(axis);
     }
     return true;
 }
@@ -356,6 +401,12 @@ static bool joydev_open(joy_device_t *joydev)
                   hwdata->index, joydev->name, SDL_GetError());
         return false;
     }
+    hwdata->id     = SDL_JoystickInstanceID(hwdata->dev);
+    hwdata->failed = false;
+
+    opened_devices = lib_realloc(opened_devices,
+                                 (num_opened_devices + 1u) * sizeof *opened_devices);
+    opened_devices[num_opened_devices++] = joydev;
     return true;
 }
 
@@ -369,6 +420,17 @@ static void joydev_close(joy_device_t *joydev)
 {
     hwdata_t *hwdata = joydev->hwdata;
 
+    for (size_t i = 0; i < num_opened_devices; i++) {
+        if (opened_devices[i] == joydev) {
+            opened_devices[i] = opened_devices[--num_opened_devices];
+            break;
+        }
+    }
+    if (num_opened_devices == 0) {
+        lib_free(opened_devices);
+        opened_devices = NULL;
+    }
+
     if (hwdata != NULL) {
         if (hwdata->dev != NULL) {
             SDL_JoystickClose(hwdata->dev);
@@ -377,7 +439,28 @@ static void joydev_close(joy_device_t *joydev)
     }
 }
 
+/** \brief  Direct events in batch to another device
+ *
+ * Submits the events gathered so far for the previous device first, so the
+ * order of events is kept.
+ *
+ * \param[in]   batch   event batch
+ * \param[in]   joydev  joystick device for the following events
+ */
+static void batch_set_device(joy_event_batch_t *batch, joy_device_t *joydev)
+{
+    if (batch->joydev != joydev) {
+        joy_event_batch_flush(batch);
+        joy_event_batch_init(batch, joydev, false);
+    }
+}
+
 /** \brief  Poll joystick device and trigger joystick events
+ *
+ * SDL has a single event queue for all joysticks: events of other opened
+ * devices are dispatched to those devices, events of devices that aren't
+ * opened are ignored. A device removed while polling another device stops
+ * being polled on its own next poll.
  *
  * \param[in]   joydev  joystick device
  *
@@ -386,51 +469,89 @@ static void joydev_close(joy_device_t *joydev)
  */
 static bool joydev_poll(joy_device_t *joydev)
 {
-    joy_axis_t   *axis;
-    joy_button_t *button;
-    joy_hat_t    *hat;
-    hwdata_t     *hwdata;
-    SDL_Event     event;
-    uint16_t      code;
+    joy_device_t      *owner;
+    joy_axis_t        *axis;
+    joy_button_t      *button;
+    joy_hat_t         *hat;
+    hwdata_t          *hwdata = joydev->hwdata;
+    SDL_Event          event;
+    joy_event_batch_t  batch;
+    uint64_t           timestamp;
+    uint64_t           now;
+    Uint32             ticks;
+    uint16_t           code;
+    int32_t            value;
+
+    joy_event_batch_init(&batch, joydev, false);
+    while (!hwdata->failed && SDL_PollEvent(&event)) {
+        /* SDL timestamps are milliseconds since SDL initialization, translate
+         * them to the joy_time_us() clock */
+        now       = joy_time_us();
+        ticks     = SDL_GetTicks();
+        timestamp = now - (uint64_t)(Uint32)(ticks - event.common.timestamp) * 1000u;
 
-    while (SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_JOYAXISMOTION:
+                owner = device_from_instance_id(event.jaxis.which);
+                if (owner == NULL) {
+                    break;
+                }
                 code = event.jaxis.axis;
-                axis = joy_axis_from_code(joydev, code);
+                axis = joy_axis_from_code(owner, code);
                 if (axis == NULL) {
                     msg_error("invalid axis code %04x\n", (unsigned int)code);
-                    return false;
+                    device_set_failed(owner);
+                    break;
                 }
                 msg_debug("EVENT: joy axis %d (%s) motion: %d\n",
                           (int)code, axis->name, (int)event.jaxis.value);
-                joy_axis_event(joydev, axis, event.jaxis.value);
+                joy_record_event(owner, JOY_INPUT_AXIS, code, event.jaxis.value, timestamp);
+                batch_set_device(&batch, owner);
+                joy_event_batch_axis(&batch,
+                                     axis,
+                                     joy_axis_value_from_hwdata(axis, event.jaxis.value),
+                                     timestamp);
                 break;
 
             case SDL_JOYBUTTONDOWN: /* fall through */
             case SDL_JOYBUTTONUP:
+                owner = device_from_instance_id(event.jbutton.which);
+                if (owner == NULL) {
+                    break;
+                }
                 code   = event.jbutton.button;
-                button = joy_button_from_code(joydev, code);
+                button = joy_button_from_code(owner, code);
                 if (button == NULL) {
                     msg_error("invalid button code %04x\n", (unsigned int)code);
-                    return false;
+                    device_set_failed(owner);
+                    break;
                 }
                 msg_debug("EVENT: joy button %d (%s) %s\n",
                           (int)code, button->name,
                           event.jbutton.state == SDL_PRESSED ? "pressed" : "released");
-                joy_button_event(joydev, button, event.jbutton.state);
+                joy_record_event(owner, JOY_INPUT_BUTTON, code, event.jbutton.state, timestamp);
+                batch_set_device(&batch, owner);
+                joy_event_batch_button(&batch, button, event.jbutton.state, timestamp);
                 break;
 
             case SDL_JOYHATMOTION:
+                owner = device_from_instance_id(event.jhat.which);
+                if (owner == NULL) {
+                    break;
+                }
                 code = event.jhat.hat;
-                hat  = joy_hat_from_code(joydev, code);
+                hat  = joy_hat_from_code(owner, code);
                 if (hat == NULL) {
                     msg_error("invalid hat code %04x\n", (unsigned int)code);
-                    return false;
+                    device_set_failed(owner);
+                    break;
                 }
                 msg_debug("EVENT: hat %d (%s) motion: %d\n",
                           (int)code, hat->name, event.jhat.value);
-                joy_hat_event(joydev, hat, sdl_hat_direction_to_vice(event.jhat.value));
+                value = sdl_hat_direction_to_vice(event.jhat.value);
+                joy_record_event(owner, JOY_INPUT_HAT, code, value, timestamp);
+                batch_set_device(&batch, owner);
+                joy_event_batch_hat(&batch, hat, value, timestamp);
                 break;
 
             case SDL_JOYDEVICEADDED:
@@ -438,11 +559,10 @@ static bool joydev_poll(joy_device_t *joydev)
                 break;
 
             case SDL_JOYDEVICEREMOVED:
-                hwdata = joydev->hwdata;
-                if (hwdata->id == event.jdevice.which) {
-                    msg_debug("EVENT: joy device %s REMOVED\n", joydev->name);
-                    /* the current device was removed */
-                    return false;
+                owner = device_from_instance_id(event.jdevice.which);
+                if (owner != NULL) {
+                    msg_debug("EVENT: joy device %s REMOVED\n", owner->name);
+                    device_set_failed(owner);
                 }
                 break;
 
@@ -451,7 +571,10 @@ static bool joydev_poll(joy_device_t *joydev)
                 break;
         }
     }
-    return true;
+
+    /* also submit the events preceding an error */
+    joy_event_batch_flush(&batch);
+    return !hwdata->failed;
 }
 
 
@@ -0,0 +1,133 @@
+/** \file   histogram.c
+ * \brief   Log-bucketed histogram of durations
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Values below \c HISTOGRAM_SUB_BUCKETS get a bucket of their own, larger
+ * values share a bucket with values that have the same highest set bit and
+ * the same \c HISTOGRAM_SUB_BITS bits below it. This keeps the relative error
+ * of percentiles bounded over the whole 64-bit range with a fixed, small
+ * number of buckets, and adding a value takes a few instructions.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+
+/** \brief  Get bucket index of value
+ *
+ * \param[in]   value   value
+ *
+ * \return  index in histogram_t::buckets
+ */
+static uint32_t bucket_index(uint64_t value)
+{
+    uint32_t msb;
+
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (uint32_t)value;
+    }
+    msb = 63u - (uint32_t)__builtin_clzll(value);
+    return (msb - HISTOGRAM_SUB_BITS + 1u) * HISTOGRAM_SUB_BUCKETS +
+           (uint32_t)((value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1u));
+}
+
+/** \brief  Get largest value that ends up in bucket
+ *
+ * \param[in]   index   bucket index
+ *
+ * \return  upper bound of bucket (inclusive)
+ */
+static uint64_t bucket_upper(uint32_t index)
+{
+    uint32_t shift;
+    uint64_t lower;
+
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    shift = index / HISTOGRAM_SUB_BUCKETS - 1u;
+    lower = (uint64_t)(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+    return lower + ((1ull << shift) - 1u);
+}
+
+
+/** \brief  Initialize histogram
+ *
+ * \param[out]  hist    histogram
+ */
+void histogram_init(histogram_t *hist)
+{
+    memset(hist, 0, sizeof *hist);
+    hist->minimum = UINT64_MAX;
+}
+
+/** \brief  Add value to histogram
+ *
+ * \param[in,out]   hist    histogram
+ * \param[in]       value   value
+ */
+void histogram_add(histogram_t *hist, uint64_t value)
+{
+    hist->buckets[bucket_index(value)]++;
+    hist->count++;
+    hist->total += value;
+    if (value < hist->minimum) {
+        hist->minimum = value;
+    }
+    if (value > hist->maximum) {
+        hist->maximum = value;
+    }
+}
+
+/** \brief  Get percentile of values in histogram
+ *
+ * \param[in]   hist        histogram
+ * \param[in]   percentile  percentile (0.0-100.0)
+ *
+ * \return  upper bound of the bucket containing the percentile, limited to
+ *          the actual minimum and maximum, or 0 if \a hist is empty
+ */
+uint64_t histogram_percentile(const histogram_t *hist, double percentile)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    rank = (uint64_t)(percentile / 100.0 * (double)hist->count + 0.5);
+    if (rank < 1u) {
+        rank = 1u;
+    } else if (rank > hist->count) {
+        rank = hist->count;
+    }
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_upper(i);
+
+            if (value > hist->maximum) {
+                value = hist->maximum;
+            }
+            if (value < hist->minimum) {
+                value = hist->minimum;
+            }
+            return value;
+        }
+    }
+    return hist->maximum;
+}
+
+/** \brief  Get mean of values in histogram
+ *
+ * \param[in]   hist    histogram
+ *
+ * \return  mean, or 0 if \a hist is empty
+ */
+uint64_t histogram_mean(const histogram_t *hist)
+{
+    return hist->count > 0 ? hist->total / hist->count : 0;
+}
@@ -0,0 +1,38 @@
+/** \file   histogram.h
+ * \brief   Log-bucketed histogram of durations - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef VICE_HISTOGRAM_H
+#define VICE_HISTOGRAM_H
+
+#include <stdint.h>
+
+/** \brief  Number of bits of a value kept below its highest set bit
+ *
+ * Determines the precision: each power of two is split into
+ * 2^HISTOGRAM_SUB_BITS buckets, so values are off by at most 12.5%.
+ */
+#define HISTOGRAM_SUB_BITS      3u
+
+/** \brief  Number of buckets per power of two */
+#define HISTOGRAM_SUB_BUCKETS   (1u << HISTOGRAM_SUB_BITS)
+
+/** \brief  Number of buckets required for 64-bit values */
+#define HISTOGRAM_BUCKETS       ((64u - HISTOGRAM_SUB_BITS + 1u) * HISTOGRAM_SUB_BUCKETS)
+
+/** \brief  Histogram of values, usually durations in microseconds */
+typedef struct histogram_s {
+    uint64_t count;                         /**< number of values */
+    uint64_t total;                         /**< sum of values */
+    uint64_t minimum;                       /**< smallest value */
+    uint64_t maximum;                       /**< largest value */
+    uint32_t buckets[HISTOGRAM_BUCKETS];    /**< number of values per bucket */
+} histogram_t;
+
+void     histogram_init      (histogram_t *hist);
+void     histogram_add       (histogram_t *hist, uint64_t value);
+uint64_t histogram_percentile(const histogram_t *hist, double percentile);
+uint64_t histogram_mean      (const histogram_t *hist);
+
+#endif
@@ -90,6 +90,48 @@ typedef struct joy_mapping_s {
     } target;                       /**< emulated input */
 } joy_mapping_t;
 
+/** \brief  Input has no transitions in the dispatch program */
+#define JOY_TRANSITIONS_NONE    UINT32_MAX
+
+/** \brief  Number of states of an input for the dispatch program
+ *
+ * Axes are negative, centered or positive, buttons released or pressed and
+ * hats are a bitmask of the four joystick directions.
+ */
+#define JOY_AXIS_NUM_STATES     3
+#define JOY_BUTTON_NUM_STATES   2
+#define JOY_HAT_NUM_STATES      16
+
+/* forward declaration for the dispatch operation handler */
+struct joy_device_s;
+
+/** \brief  Single operation in a compiled dispatch program
+ *
+ * Applies \c value to the emulated input described by \c mapping.
+ */
+typedef struct joy_dispatch_op_s {
+    /** \brief  Handler for the mapping's action type */
+    void (*perform)(struct joy_device_s *joydev,
+                    const joy_mapping_t *mapping,
+                    int32_t              value);
+    const joy_mapping_t *mapping;   /**< mapping to apply */
+    int32_t              value;     /**< value to apply (1 = press, 0 = release) */
+} joy_dispatch_op_t;
+
+/** \brief  Compiled dispatch program of a device
+ *
+ * Each input with mappings owns a block of transitions, one for each
+ * (previous state, new state) pair, starting at its \c transitions member.
+ * The operations for transition \c t are \c ops[first[t]] up to (but not
+ * including) \c ops[first[t + 1]].
+ */
+typedef struct joy_program_s {
+    joy_dispatch_op_t *ops;             /**< operations of all transitions */
+    uint32_t          *first;           /**< index in \c ops per transition */
+    uint32_t           num_ops;         /**< number of operations */
+    uint32_t           num_transitions; /**< number of transitions */
+} joy_program_t;
+
 /** \brief  Hat directions
  */
 typedef enum {
@@ -133,11 +175,15 @@ typedef enum joystick_axis_value_e {
 #define JOYSTICK_BUTTON_SNES_SELECT 1024    /**< SNES pad Select button */
 #define JOYSTICK_BUTTON_SNES_START  2048    /**< SNES pad Start button */
 
+/** \brief  Number of emulated ports a device can be assigned to */
+#define JOY_NUM_PORTS   11
+
 /** \brief  Joystick button object */
 typedef struct joy_button_s {
     uint16_t           code;        /**< event code */
     char              *name;        /**< button name */
     int32_t            prev;        /**< previous value */
+    uint32_t           transitions; /**< first transition in dispatch program */
     joy_mapping_t      mapping;     /**< input mapping */
     joy_calibration_t  calibration; /**< button calibration */
 } joy_button_t;
@@ -147,6 +193,7 @@ typedef struct joy_axis_s {
     uint16_t       code;        /**< event code */
     char          *name;        /**< name */
     int32_t        prev;        /**< previous value */
+    uint32_t       transitions; /**< first transition in dispatch program */
     int32_t        minimum;     /**< minimum value */
     int32_t        maximum;     /**< maximum value */
     int32_t        fuzz;        /**< noise removed by dev driver (Linux) */
@@ -174,6 +221,7 @@ typedef struct joy_hat_s {
     uint16_t             code;  /**< code in case of USB hat switch (BSD) */
     char                *name;  /**< name */
     int32_t              prev;  /**< previous value */
+    uint32_t             transitions;   /**< first transition in dispatch program */
     joy_hat_direction_t  hat_map[JOY_HAT_NUM_DIRECTIONS];   /* hat mapping */
     struct {
         joy_mapping_t up;           /**< up direction of hat */
@@ -189,6 +237,35 @@ typedef struct joy_hat_s {
     } calibration;              /**< calibration for hat directions */
 } joy_hat_t;
 
+/** \brief  Lookup table mapping event codes to inputs
+ *
+ * Dense table covering the codes \c base to \c base + \c size - 1, each
+ * entry holding the index of the input in the device's list of axes, buttons
+ * or hats, plus one. An entry of \c 0 means there is no input for that code.
+ */
+typedef struct joy_code_index_s {
+    uint32_t *table;    /**< input index + 1 per code, 0 = no input */
+    uint32_t  size;     /**< number of entries in \c table */
+    uint16_t  base;     /**< lowest code in \c table */
+} joy_code_index_t;
+
+/** \brief  Slot in input name lookup table */
+typedef struct joy_name_slot_s {
+    const char *name;   /**< input name (owned by the input) */
+    uint32_t    hash;   /**< hash of \c name */
+    uint32_t    input;  /**< input index + 1, 0 = empty slot */
+} joy_name_slot_t;
+
+/** \brief  Lookup table mapping input names to inputs
+ *
+ * Open-addressing hash table with linear probing, the number of slots is a
+ * power of two and at least twice the number of inputs.
+ */
+typedef struct joy_name_index_s {
+    joy_name_slot_t *slots; /**< slots, \c NULL when no table was built */
+    uint32_t         mask;  /**< number of slots - 1 */
+} joy_name_index_t;
+
 /** \brief  Joystick device object */
 typedef struct joy_device_s {
     char         *name;             /**< name */
@@ -206,12 +283,62 @@ typedef struct joy_device_s {
     joy_axis_t   *axes;             /**< list of axes */
     joy_hat_t    *hats;             /**< list of hats */
 
+    joy_code_index_t axis_index;    /**< axis code lookup table */
+    joy_code_index_t button_index;  /**< button code lookup table */
+    joy_code_index_t hat_index;     /**< hat code lookup table */
+    joy_name_index_t axis_names;    /**< axis name lookup table */
+    joy_name_index_t button_names;  /**< button name lookup table */
+    joy_name_index_t hat_names;     /**< hat name lookup table */
+    joy_program_t    program;       /**< compiled mappings */
+
     int           port;             /**< port number (0-based, -1 = unassigned) */
     uint32_t      capabilities;     /**< capabilities bitmask */
+    uint64_t      timestamp;        /**< time of event being dispatched
+                                         (0 = unknown) */
 
     void         *hwdata;           /**< used for driver/arch-specific data */
 } joy_device_t;
 
+/** \brief  Host input event for batched submission
+ *
+ * \see joy_events_submit()
+ */
+typedef struct joy_event_s {
+    joy_input_t         type;       /**< input type */
+    union {
+        joy_axis_t     *axis;       /**< axis for JOY_INPUT_AXIS */
+        joy_button_t   *button;     /**< button for JOY_INPUT_BUTTON */
+        joy_hat_t      *hat;        /**< hat for JOY_INPUT_HAT */
+    } input;                        /**< input triggering the event */
+    int32_t             value;      /**< axis value, button state or hat
+                                         directions bitmask */
+    uint64_t            timestamp;  /**< time of event in microseconds on
+                                         the \c joy_time_us() clock
+                                         (0 = unknown) */
+} joy_event_t;
+
+/** \brief  Number of events in a batch before it gets submitted */
+#define JOY_EVENT_BATCH_SIZE    64
+
+/** \brief  Batch of events gathered by a driver during a single poll */
+typedef struct joy_event_batch_s {
+    joy_device_t *joydev;                       /**< device */
+    uint32_t      count;                        /**< number of events */
+    bool          frame;                        /**< events form a single frame
+                                                     reported by the device,
+                                                     see \c joy_frame_submit() */
+    joy_event_t   events[JOY_EVENT_BATCH_SIZE]; /**< events */
+} joy_event_batch_t;
+
+/** \brief  Callback for devices added to or removed from the device list
+ *
+ * Called after \a joydev was added to the list, or right before \a joydev is
+ * removed from the list and freed.
+ *
+ * \see joy_hotplug_poll()
+ */
+typedef void (*joy_hotplug_func_t)(joy_device_t *joydev, bool added);
+
 /** \brief  Joystick driver registration object
  */
 typedef struct joy_driver_s {
@@ -219,6 +346,30 @@ typedef struct joy_driver_s {
     bool (*poll)       (joy_device_t *joydev);  /**< poll device */
     void (*close)      (joy_device_t *joydev);  /**< close device */
     void (*hwdata_free)(void         *hwdata);  /**< free hardware-specific data */
+
+    /* optional: event-driven polling of devices in a separate thread */
+    bool (*thread_start) (joy_device_t **devices, size_t count);
+                                                /**< start input thread */
+    void (*thread_stop)  (void);                /**< stop input thread */
+    bool (*thread_active)(void);                /**< input thread still polls
+                                                     devices */
+    bool (*thread_add)   (joy_device_t *joydev);
+                                                /**< add device to running
+                                                     input thread */
+    bool (*thread_lost)  (joy_device_t *joydev);
+                                                /**< input thread stopped
+                                                     polling failed device */
+
+    /* optional: detection of devices being plugged in or removed */
+    bool (*hotplug_start)(void);                /**< start watching devices */
+    void (*hotplug_stop) (void);                /**< stop watching devices */
+    int  (*hotplug_poll) (joy_device_t ***devices, joy_hotplug_func_t callback);
+                                                /**< update device list */
+
+    /* optional: periodic housekeeping */
+    void (*idle)         (joy_device_t **devices);
+                                                /**< release resources of
+                                                     devices not polled */
 } joy_driver_t;
 
 /** \brief  Joymap file object
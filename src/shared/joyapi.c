@@ -14,9 +14,12 @@
 #include <string.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <time.h>
+#ifdef WINDOWS_COMPILE
+#include <windows.h>
+#endif
 
 #include "lib.h"
-#include "uiactions.h"
 
 #include "joyapi.h"
 
@@ -57,12 +60,45 @@ static const char *joy_direction_names[16] = {
  */
 #define joy_direction_name(mask) (joy_direction_names[mask & 0x0f])
 
+/** \brief  Maximum number of entries in a code lookup table
+ *
+ * Devices with a larger spread of event codes for an input type fall back to
+ * scanning the list of inputs.
+ */
+#define CODE_INDEX_MAX_SIZE 4096u
+
 /** \brief  Arch-specific callbacks for the joystick system
  *
  * Must be set by the arch-specific code by calling \c joy_driver_register().
  */
 static joy_driver_t driver;
 
+/** \brief  Updates of emulated ports, consumed by the emulation thread */
+static joy_queue_t port_queue;
+
+/** \brief  State of emulated joystick ports
+ *
+ * Bitmask of JOYSTICK_DIRECTION_* and JOYSTICK_BUTTON_* pins per port, set and
+ * cleared by the input thread, read by the emulation thread with
+ * \c joy_port_read().
+ */
+static uint32_t port_state[JOY_NUM_PORTS];
+
+/** \brief  Pin changes of the frame being submitted
+ *
+ * While a frame of events is processed by \c joy_frame_submit() the pin
+ * changes are applied to a copy of the port state, which is published once
+ * the whole list has been processed. So a frame that moves a stick or hat
+ * diagonally results in a single update of the port, instead of passing
+ * through a state where only one of the directions is active.
+ */
+static struct {
+    bool     active;                /**< frame is being submitted */
+    uint32_t ports;                 /**< bitmask of ports changed in frame */
+    uint32_t state[JOY_NUM_PORTS];  /**< new state of changed ports */
+    uint64_t timestamp;             /**< time of latest event in frame */
+} frame;
+
 
 /** \brief  Register arch-specific callbacks for the joystick system
  *
@@ -74,6 +110,245 @@ void joy_driver_register(const joy_driver_t *drv)
     driver.close       = drv->close;
     driver.poll        = drv->poll;
     driver.hwdata_free = drv->hwdata_free;
+
+    driver.thread_start  = drv->thread_start;
+    driver.thread_stop   = drv->thread_stop;
+    driver.thread_active = drv->thread_active;
+    driver.thread_add    = drv->thread_add;
+    driver.thread_lost   = drv->thread_lost;
+
+    driver.hotplug_start = drv->hotplug_start;
+    driver.hotplug_stop  = drv->hotplug_stop;
+    driver.hotplug_poll  = drv->hotplug_poll;
+
+    driver.idle          = drv->idle;
+}
+
+
+/** \brief  Initialize code lookup table to empty
+ *
+ * \param[in]   index   code lookup table
+ */
+static void code_index_init(joy_code_index_t *index)
+{
+    index->table = NULL;
+    index->size  = 0;
+    index->base  = 0;
+}
+
+/** \brief  Free code lookup table
+ *
+ * \param[in]   index   code lookup table
+ */
+static void code_index_free(joy_code_index_t *index)
+{
+    lib_free(index->table);
+    code_index_init(index);
+}
+
+/** \brief  Build code lookup table
+ *
+ * Create a dense table mapping each code in \a codes to its index in \a codes.
+ * If a code occurs more than once the first occurrence is used, just like a
+ * linear scan would. If the range of codes is larger than
+ * \c CODE_INDEX_MAX_SIZE no table is built.
+ *
+ * \param[in]   index   code lookup table
+ * \param[in]   codes   list of codes
+ * \param[in]   count   number of elements in \a codes
+ */
+static void code_index_build(joy_code_index_t *index,
+                             const uint16_t   *codes,
+                             uint32_t          count)
+{
+    uint16_t lo = UINT16_MAX;
+    uint16_t hi = 0;
+    uint32_t i;
+
+    code_index_free(index);
+    if (count == 0) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (codes[i] < lo) {
+            lo = codes[i];
+        }
+        if (codes[i] > hi) {
+            hi = codes[i];
+        }
+    }
+    if ((uint32_t)(hi - lo) + 1u > CODE_INDEX_MAX_SIZE) {
+        msg_debug("code range %04x-%04x too large, not indexing\n",
+                  (unsigned int)lo, (unsigned int)hi);
+        return;
+    }
+
+    index->base  = lo;
+    index->size  = (uint32_t)(hi - lo) + 1u;
+    index->table = lib_malloc(index->size * sizeof *(index->table));
+    memset(index->table, 0, index->size * sizeof *(index->table));
+    for (i = 0; i < count; i++) {
+        uint32_t *slot = &(index->table[codes[i] - lo]);
+
+        if (*slot == 0) {
+            *slot = i + 1u;
+        }
+    }
+}
+
+/** \brief  Look up input index in code lookup table
+ *
+ * \param[in]   index   code lookup table
+ * \param[in]   code    event code
+ *
+ * \return  index of input plus one, or 0 when no input for \a code exists
+ *
+ * \note    Only valid when \c index->table isn't \c NULL
+ */
+static inline uint32_t code_index_lookup(const joy_code_index_t *index,
+                                         uint16_t                code)
+{
+    /* codes below the base wrap around and fail the range check */
+    uint32_t offset = (uint32_t)code - index->base;
+
+    return offset < index->size ? index->table[offset] : 0;
+}
+
+
+/** \brief  Calculate hash of input name
+ *
+ * FNV-1a hash of the first \a len characters of \a name.
+ *
+ * \param[in]   name    input name
+ * \param[in]   len     length of \a name
+ *
+ * \return  hash
+ */
+static uint32_t name_hash(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** \brief  Initialize name lookup table to empty
+ *
+ * \param[in]   index   name lookup table
+ */
+static void name_index_init(joy_name_index_t *index)
+{
+    index->slots = NULL;
+    index->mask  = 0;
+}
+
+/** \brief  Free name lookup table
+ *
+ * \param[in]   index   name lookup table
+ */
+static void name_index_free(joy_name_index_t *index)
+{
+    lib_free(index->slots);
+    name_index_init(index);
+}
+
+/** \brief  Look up input index in name lookup table
+ *
+ * \param[in]   index   name lookup table
+ * \param[in]   name    input name (doesn't need to be nul-terminated)
+ * \param[in]   len     length of \a name
+ *
+ * \return  index of input plus one, or 0 when no input is called \a name
+ *
+ * \note    Only valid when \c index->slots isn't \c NULL
+ */
+static uint32_t name_index_lookup(const joy_name_index_t *index,
+                                  const char             *name,
+                                  size_t                  len)
+{
+    uint32_t hash = name_hash(name, len);
+    uint32_t i    = hash & index->mask;
+
+    while (index->slots[i].input != 0) {
+        const joy_name_slot_t *slot = &(index->slots[i]);
+
+        if (slot->hash == hash &&
+                strncmp(slot->name, name, len) == 0 && slot->name[len] == '\0') {
+            return slot->input;
+        }
+        i = (i + 1u) & index->mask;
+    }
+    return 0;
+}
+
+/** \brief  Build name lookup table
+ *
+ * If a name occurs more than once the first occurrence is used, just like a
+ * linear scan would.
+ *
+ * \param[in]   index   name lookup table
+ * \param[in]   names   list of input names
+ * \param[in]   count   number of elements in \a names
+ */
+static void name_index_build(joy_name_index_t  *index,
+                             const char       **names,
+                             uint32_t           count)
+{
+    uint32_t size = 8u;
+
+    name_index_free(index);
+    if (count == 0) {
+        return;
+    }
+
+    while (size < count * 2u) {
+        size *= 2u;
+    }
+    index->mask  = size - 1u;
+    index->slots = lib_malloc(size * sizeof *(index->slots));
+    memset(index->slots, 0, size * sizeof *(index->slots));
+
+    for (uint32_t n = 0; n < count; n++) {
+        size_t   len;
+        uint32_t hash;
+        uint32_t i;
+
+        if (names[n] == NULL) {
+            continue;
+        }
+        len = strlen(names[n]);
+        if (name_index_lookup(index, names[n], len) != 0) {
+            /* duplicate name */
+            continue;
+        }
+        hash = name_hash(names[n], len);
+        i    = hash & index->mask;
+        while (index->slots[i].input != 0) {
+            i = (i + 1u) & index->mask;
+        }
+        index->slots[i].name  = names[n];
+        index->slots[i].hash  = hash;
+        index->slots[i].input = n + 1u;
+    }
+}
+
+
+/** \brief  Free dispatch program
+ *
+ * \param[in]   program dispatch program
+ */
+static void program_free(joy_program_t *program)
+{
+    lib_free(program->ops);
+    lib_free(program->first);
+    program->ops             = NULL;
+    program->first           = NULL;
+    program->num_ops         = 0;
+    program->num_transitions = 0;
 }
 
 
@@ -118,8 +393,21 @@ joy_device_t *joy_device_new(void)
     dev->axes         = NULL;
     dev->hats         = NULL;
 
+    code_index_init(&dev->axis_index);
+    code_index_init(&dev->button_index);
+    code_index_init(&dev->hat_index);
+    name_index_init(&dev->axis_names);
+    name_index_init(&dev->button_names);
+    name_index_init(&dev->hat_names);
+
+    dev->program.ops             = NULL;
+    dev->program.first           = NULL;
+    dev->program.num_ops         = 0;
+    dev->program.num_transitions = 0;
+
     dev->port         = -1;  /* unassigned */
     dev->capabilities = JOY_CAPS_NONE;  /* cannot be mapped to any emulated input */
+    dev->timestamp    = 0;
 
     dev->hwdata       = NULL;
 
@@ -150,6 +438,14 @@ void joy_device_free(joy_device_t *joydev)
     lib_free(joydev->name);
     lib_free(joydev->node);
 
+    code_index_free(&joydev->axis_index);
+    code_index_free(&joydev->button_index);
+    code_index_free(&joydev->hat_index);
+    name_index_free(&joydev->axis_names);
+    name_index_free(&joydev->button_names);
+    name_index_free(&joydev->hat_names);
+    program_free(&joydev->program);
+
     if (joydev->axes != NULL) {
         for (i = 0; i < joydev->num_axes; i++) {
             lib_free(joydev->axes[i].name);
@@ -244,6 +540,11 @@ joy_device_t *joy_device_get(joy_device_t **devices, const char *node)
 const char *joy_device_get_axis_name(const joy_device_t *joydev, uint16_t axis)
 {
     if (joydev != NULL) {
+        if (joydev->axis_index.table != NULL) {
+            uint32_t slot = code_index_lookup(&joydev->axis_index, axis);
+
+            return slot > 0 ? joydev->axes[slot - 1u].name : NULL;
+        }
         for (size_t i = 0; i < joydev->num_axes; i++) {
             if (joydev->axes[i].code == axis) {
                 return joydev->axes[i].name;
@@ -264,6 +565,11 @@ const char *joy_device_get_axis_name(const joy_device_t *joydev, uint16_t axis)
 const char *joy_device_get_button_name(const joy_device_t *joydev, uint16_t button)
 {
     if (joydev != NULL) {
+        if (joydev->button_index.table != NULL) {
+            uint32_t slot = code_index_lookup(&joydev->button_index, button);
+
+            return slot > 0 ? joydev->buttons[slot - 1u].name : NULL;
+        }
         for (size_t i = 0; i < joydev->num_buttons; i++) {
             if (joydev->buttons[i].code == button) {
                 return joydev->buttons[i].name;
@@ -284,6 +590,11 @@ const char *joy_device_get_button_name(const joy_device_t *joydev, uint16_t butt
 const char *joy_device_get_hat_name(const joy_device_t *joydev, uint16_t hat)
 {
     if (joydev != NULL) {
+        if (joydev->hat_index.table != NULL) {
+            uint32_t slot = code_index_lookup(&joydev->hat_index, hat);
+
+            return slot > 0 ? joydev->hats[slot - 1u].name : NULL;
+        }
         for (size_t i = 0; i < joydev->num_hats; i++) {
             if (joydev->hats[i].code == hat) {
                 return joydev->hats[i].name;
@@ -326,6 +637,7 @@ void joy_axis_init(joy_axis_t *axis)
     axis->code        = 0;
     axis->name        = NULL;
     axis->prev        = 0;
+    axis->transitions = JOY_TRANSITIONS_NONE;
     axis->minimum     = INT16_MIN;
     axis->maximum     = INT16_MAX;
     axis->fuzz        = 0;
@@ -377,6 +689,7 @@ void joy_button_init(joy_button_t *button)
     button->code = 0;
     button->name = NULL;
     button->prev = 0;
+    button->transitions = JOY_TRANSITIONS_NONE;
     joy_mapping_init(&button->mapping);
     joy_calibration_init(&button->calibration);
 }
@@ -391,6 +704,7 @@ void joy_hat_init(joy_hat_t *hat)
     hat->name = NULL;
     hat->code = 0;
     hat->prev = 0;
+    hat->transitions = JOY_TRANSITIONS_NONE;
     for (size_t i = 0; i < ARRAY_LEN(hat->hat_map); i++) {
         hat->hat_map[i] = JOY_HAT_CENTERED;
     }
@@ -406,6 +720,9 @@ void joy_hat_init(joy_hat_t *hat)
 
 
 /** \brief  Get axis by axis code
+ *
+ * Uses the device's code lookup table when available, otherwise falls back
+ * to scanning the list of axes.
  *
  * \param[in]   joydev  joystick device
  * \param[in]   code    axis code
@@ -414,6 +731,11 @@ void joy_hat_init(joy_hat_t *hat)
  */
 joy_axis_t *joy_axis_from_code(joy_device_t *joydev, uint16_t code)
 {
+    if (joydev->axis_index.table != NULL) {
+        uint32_t slot = code_index_lookup(&joydev->axis_index, code);
+
+        return slot > 0 ? &(joydev->axes[slot - 1u]) : NULL;
+    }
     for (uint32_t a = 0; a < joydev->num_axes; a++) {
         if (joydev->axes[a].code == code) {
             return &(joydev->axes[a]);
@@ -432,8 +754,32 @@ joy_axis_t *joy_axis_from_code(joy_device_t *joydev, uint16_t code)
  */
 joy_axis_t *joy_axis_from_name(joy_device_t *joydev, const char *name)
 {
+    return joy_axis_from_name_len(joydev, name, strlen(name));
+}
+
+
+/** \brief  Get axis by axis name of given length
+ *
+ * Uses the device's name lookup table when available, otherwise falls back
+ * to scanning the list of axes.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   name    axis name (doesn't need to be nul-terminated)
+ * \param[in]   len     length of \a name
+ *
+ * \return  axis or \c NULL when not found
+ */
+joy_axis_t *joy_axis_from_name_len(joy_device_t *joydev, const char *name, size_t len)
+{
+    if (joydev->axis_names.slots != NULL) {
+        uint32_t slot = name_index_lookup(&joydev->axis_names, name, len);
+
+        return slot > 0 ? &(joydev->axes[slot - 1u]) : NULL;
+    }
     for (uint32_t a = 0; a < joydev->num_axes; a++) {
-        if (strcmp(joydev->axes[a].name, name) == 0) {
+        const char *s = joydev->axes[a].name;
+
+        if (strncmp(s, name, len) == 0 && s[len] == '\0') {
             return &(joydev->axes[a]);
         }
     }
@@ -471,6 +817,9 @@ joystick_axis_value_t joy_axis_value_from_hwdata(joy_axis_t *axis, int32_t hw_va
 
 
 /** \brief  Get button by button code
+ *
+ * Uses the device's code lookup table when available, otherwise falls back
+ * to scanning the list of buttons.
  *
  * \param[in]   joydev  joystick device
  * \param[in]   code    button code
@@ -479,6 +828,11 @@ joystick_axis_value_t joy_axis_value_from_hwdata(joy_axis_t *axis, int32_t hw_va
  */
 joy_button_t *joy_button_from_code(joy_device_t *joydev, uint16_t code)
 {
+    if (joydev->button_index.table != NULL) {
+        uint32_t slot = code_index_lookup(&joydev->button_index, code);
+
+        return slot > 0 ? &(joydev->buttons[slot - 1u]) : NULL;
+    }
     for (uint32_t b = 0; b < joydev->num_buttons; b++) {
         if (joydev->buttons[b].code == code) {
             return &(joydev->buttons[b]);
@@ -497,8 +851,29 @@ joy_button_t *joy_button_from_code(joy_device_t *joydev, uint16_t code)
  */
 joy_button_t *joy_button_from_name(joy_device_t *joydev, const char *name)
 {
+    return joy_button_from_name_len(joydev, name, strlen(name));
+}
+
+
+/** \brief  Get button by button name of given length
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   name    button name (doesn't need to be nul-terminated)
+ * \param[in]   len     length of \a name
+ *
+ * \return  button or \c NULL when not found
+ */
+joy_button_t *joy_button_from_name_len(joy_device_t *joydev, const char *name, size_t len)
+{
+    if (joydev->button_names.slots != NULL) {
+        uint32_t slot = name_index_lookup(&joydev->button_names, name, len);
+
+        return slot > 0 ? &(joydev->buttons[slot - 1u]) : NULL;
+    }
     for (uint32_t b = 0; b < joydev->num_buttons; b++) {
-        if (strcmp(joydev->buttons[b].name, name) == 0) {
+        const char *s = joydev->buttons[b].name;
+
+        if (strncmp(s, name, len) == 0 && s[len] == '\0') {
             return &(joydev->buttons[b]);
         }
     }
@@ -507,6 +882,9 @@ joy_button_t *joy_button_from_name(joy_device_t *joydev, const char *name)
 
 
 /** \brief  Get hat by hat code
+ *
+ * Uses the device's code lookup table when available, otherwise falls back
+ * to scanning the list of hats.
  *
  * \param[in]   joydev  joystick device
  * \param[in]   code    hat code
@@ -515,6 +893,11 @@ joy_button_t *joy_button_from_name(joy_device_t *joydev, const char *name)
  */
 joy_hat_t *joy_hat_from_code(joy_device_t *joydev, uint16_t code)
 {
+    if (joydev->hat_index.table != NULL) {
+        uint32_t slot = code_index_lookup(&joydev->hat_index, code);
+
+        return slot > 0 ? &(joydev->hats[slot - 1u]) : NULL;
+    }
     for (uint32_t h = 0; h < joydev->num_hats; h++) {
         if (joydev->hats[h].code == code) {
             return &(joydev->hats[h]);
@@ -533,8 +916,29 @@ joy_hat_t *joy_hat_from_code(joy_device_t *joydev, uint16_t code)
  */
 joy_hat_t *joy_hat_from_name(joy_device_t *joydev, const char *name)
 {
+    return joy_hat_from_name_len(joydev, name, strlen(name));
+}
+
+
+/** \brief  Get hat by hat name of given length
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   name    hat name (doesn't need to be nul-terminated)
+ * \param[in]   len     length of \a name
+ *
+ * \return  hat or \c NULL when not found
+ */
+joy_hat_t *joy_hat_from_name_len(joy_device_t *joydev, const char *name, size_t len)
+{
+    if (joydev->hat_names.slots != NULL) {
+        uint32_t slot = name_index_lookup(&joydev->hat_names, name, len);
+
+        return slot > 0 ? &(joydev->hats[slot - 1u]) : NULL;
+    }
     for (uint32_t h = 0; h < joydev->num_hats; h++) {
-        if (strcmp(joydev->hats[h].name, name) == 0) {
+        const char *s = joydev->hats[h].name;
+
+        if (strncmp(s, name, len) == 0 && s[len] == '\0') {
             return &(joydev->hats[h]);
         }
     }
@@ -542,179 +946,772 @@ joy_hat_t *joy_hat_from_name(joy_device_t *joydev, const char *name)
 }
 
 
-/** \brief  Perform joystick event
+/** \brief  Handler for a mapping's action type in a dispatch program */
+typedef void (*perform_func_t)(joy_device_t        *joydev,
+                               const joy_mapping_t *mapping,
+                               int32_t              value);
+
+
+/** \brief  Queue update of emulated input
  *
  * \param[in]   joydev  joystick device
- * \param[in]   event   event data
+ * \param[in]   mapping mapping
  * \param[in]   value   event value
  */
-static void joy_perform_event(joy_device_t  *joydev,
-                              joy_mapping_t *event,
-                              int32_t        value)
+static void perform_queue(joy_device_t        *joydev,
+                          const joy_mapping_t *mapping,
+                          int32_t              value)
 {
-    joy_key_map_t *key;
-
-    switch (event->action) {
-        case JOY_ACTION_NONE:
-            printf("event: port %d - NONE - value: %"PRId32"\n",
-                   joydev->port, value);
-            break;
-        case JOY_ACTION_JOYSTICK:
-            printf("event: port %d - JOYSTICK - pin: %d, value: %"PRId32"\n",
-                   joydev->port, event->target.pin, value);
-            break;
-        case JOY_ACTION_KEYBOARD:
-            key = &(event->target.key);
-            printf("event: port %d - KEYBOARD - row: %d, column: %d, flags: %02"PRIx32", value: %"PRId32"\n",
-                   joydev->port, key->row, key->column, key->flags, value);
-            break;
-        case JOY_ACTION_POT_AXIS:
-            printf("event: port %d: - POT %c - value: %02"PRIx32"\n",
-                   joydev->port, event->target.pot == JOY_POTX ? 'X' : 'Y', value);
-            break;
-        case JOY_ACTION_UI_ACTION:
-            if (value) {
-                printf("event: value: %"PRId32", UI ACTION %d (%s)\n",
-                        value, event->target.ui_action, ui_action_get_name(event->target.ui_action));
-            }
-            break;
-        case JOY_ACTION_UI_ACTIVATE:
-            printf("event: UI ACTIVATE\n");
-            break;
-        default:
-            break;
+    joy_port_update_t update;
+
+    update.port      = joydev->port;
+    update.value     = value;
+    update.mapping   = *mapping;
+    update.timestamp = joydev->timestamp;
+    update.queued    = joydev->timestamp != 0 ? joy_time_us() : 0;
+    if (!joy_queue_push(&port_queue, &update)) {
+        msg_debug("port queue full, dropping update\n");
     }
 }
 
-
-/** \brief  Joystick axis event
+/** \brief  Update emulated joystick pin in the frame being submitted
  *
- * \param[in]   joydev  joystick device triggering the event
- * \param[in]   axis    axis object
- * \param[in]   value   axis value
+ * \param[in]   joydev  joystick device
+ * \param[in]   mapping mapping with pin
+ * \param[in]   value   event value
  */
-void joy_axis_event(joy_device_t *joydev, joy_axis_t *axis, joystick_axis_value_t value)
+static void frame_pin(joy_device_t        *joydev,
+                      const joy_mapping_t *mapping,
+                      int32_t              value)
 {
-    joystick_axis_value_t prev;
+    int      port = joydev->port;
+    uint32_t pin  = (uint32_t)mapping->target.pin;
 
-    if (axis == NULL) {
-        msg_error("`axis` is NULL\n");
+    if (port < 0 || port >= JOY_NUM_PORTS) {
         return;
     }
-
-    msg_verbose("axis event: %s: %s (%"PRIx16"), value: %"PRId32"\n",
-                joydev->name, axis->name, axis->code, value);
-
-    prev = (joystick_axis_value_t)axis->prev;
-    if (value == prev) {
-        return;
+    if (!(frame.ports & (1u << port))) {
+        /* only the input thread writes the port state */
+        frame.state[port] = __atomic_load_n(&port_state[port], __ATOMIC_RELAXED);
+        frame.ports      |= 1u << port;
     }
-
-    /* release directions first */
-    if (prev == JOY_AXIS_NEGATIVE) {
-        joy_perform_event(joydev, &(axis->mapping.negative), 0);
-    } else if (prev == JOY_AXIS_POSITIVE) {
-        joy_perform_event(joydev, &(axis->mapping.positive), 0);
+    if (value) {
+        frame.state[port] |= pin;
+    } else {
+        frame.state[port] &= ~pin;
     }
-
-    /* new directions */
-    if (value == JOY_AXIS_NEGATIVE) {
-        joy_perform_event(joydev, &(axis->mapping.negative), 1);
-    } else if (value == JOY_AXIS_POSITIVE) {
-        joy_perform_event(joydev, &(axis->mapping.positive), 1);
+    if (joydev->timestamp > frame.timestamp) {
+        frame.timestamp = joydev->timestamp;
     }
-
-    /* update previous */
-    axis->prev = (int32_t)value;
 }
 
+/** \brief  Start collecting pin changes of a frame */
+static void frame_begin(void)
+{
+    frame.active    = true;
+    frame.ports     = 0;
+    frame.timestamp = 0;
+}
 
-/** \brief  Joystick button event
+/** \brief  Publish pin changes of a frame
  *
- * \param[in]   joydev  joystick device triggering the event
- * \param[in]   button  button object
- * \param[in]   value   button value
+ * Update the state of each changed port at once and queue an update for each
+ * pin whose state differs from before the frame. Pins that were set and
+ * cleared again within the frame don't produce updates.
  */
-void joy_button_event(joy_device_t *joydev, joy_button_t *button, int32_t value)
+static void frame_end(void)
 {
-    if (button == NULL) {
-        msg_error("error: `button` is NULL\n");
-        return;
-    }
+    uint64_t queued = frame.timestamp != 0 ? joy_time_us() : 0;
 
-    msg_verbose("button event: %s: %s (%"PRIx16"), value: %"PRId32"\n",
-                joydev->name, button->name, button->code, value);
-    joy_perform_event(joydev, &(button->mapping), value);
+    frame.active = false;
+    for (int port = 0; port < JOY_NUM_PORTS; port++) {
+        uint32_t old;
+        uint32_t changed;
 
+        if (!(frame.ports & (1u << port))) {
+            continue;
+        }
+        old     = __atomic_load_n(&port_state[port], __ATOMIC_RELAXED);
+        changed = old ^ frame.state[port];
+        if (changed == 0) {
+            continue;
+        }
+        __atomic_store_n(&port_state[port], frame.state[port], __ATOMIC_RELEASE);
+
+        while (changed != 0) {
+            uint32_t          pin = changed & (~changed + 1u);  /* lowest bit */
+            joy_port_update_t update;
+
+            update.port               = port;
+            update.value              = (frame.state[port] & pin) ? 1 : 0;
+            update.mapping.action     = JOY_ACTION_JOYSTICK;
+            update.mapping.target.pin = (int)pin;
+            update.timestamp          = frame.timestamp;
+            update.queued             = queued;
+            if (!joy_queue_push(&port_queue, &update)) {
+                msg_debug("port queue full, dropping update\n");
+            }
+            changed &= changed - 1u;
+        }
+    }
 }
 
-
-/** \brief  Joystick hat event
+/** \brief  Update emulated joystick pin and queue update
  *
- * \param[in]   joydev  joystick device triggering the event
- * \param[in]   hat     hat object
- * \param[in]   value   hat value (joystick pins bitmask)
+ * \param[in]   joydev  joystick device
+ * \param[in]   mapping mapping with pin
+ * \param[in]   value   event value
  */
-void joy_hat_event(joy_device_t  *joydev,
-                   joy_hat_t     *hat,
-                   int32_t        value)
+static void perform_pin(joy_device_t        *joydev,
+                        const joy_mapping_t *mapping,
+                        int32_t              value)
 {
-    joy_mapping_t *up;
-    joy_mapping_t *down;
-    joy_mapping_t *left;
-    joy_mapping_t *right;
-    int32_t        prev;
-
-    if (hat == NULL) {
-        msg_error("`hat` is NULL\n");
+    if (frame.active) {
+        frame_pin(joydev, mapping, value);
         return;
     }
-    prev = hat->prev;
-    if (prev == value) {
-        return;
+    if (joydev->port >= 0 && joydev->port < JOY_NUM_PORTS) {
+        uint32_t *state = &port_state[joydev->port];
+        uint32_t  pin   = (uint32_t)mapping->target.pin;
+
+        /* single writer, but the emulation thread can read at any time */
+        if (value) {
+            __atomic_fetch_or(state, pin, __ATOMIC_RELEASE);
+        } else {
+            __atomic_fetch_and(state, ~pin, __ATOMIC_RELEASE);
+        }
     }
+    perform_queue(joydev, mapping, value);
+}
 
-    up    = &hat->mapping.up;
-    down  = &hat->mapping.down;
-    left  = &hat->mapping.left;
-    right = &hat->mapping.right;
-
-    msg_verbose("hat event: %s: %s (%"PRIx16"), value: %"PRId32": %s\n",
-                joydev->name, hat->name, hat->code, value,
-                joy_direction_name((uint32_t)value));
-
-    /* the following will also send "release" events for UI actions, but
-     * joy_perform_event() will handle (ignore) those */
-    if ((prev & JOYSTICK_DIRECTION_UP) != (value & JOYSTICK_DIRECTION_UP)) {
-        joy_perform_event(joydev, up, value & JOYSTICK_DIRECTION_UP ? 1 : 0);
-    }
-    if ((prev & JOYSTICK_DIRECTION_DOWN) != (value & JOYSTICK_DIRECTION_DOWN)) {
-        joy_perform_event(joydev, down, value & JOYSTICK_DIRECTION_DOWN ? 1 : 0);
-    }
-    if ((prev & JOYSTICK_DIRECTION_LEFT) != (value & JOYSTICK_DIRECTION_LEFT)) {
-        joy_perform_event(joydev, left, value & JOYSTICK_DIRECTION_LEFT ? 1 : 0);
-    }
-    if ((prev & JOYSTICK_DIRECTION_RIGHT) != (value & JOYSTICK_DIRECTION_RIGHT)) {
-        joy_perform_event(joydev, right, value & JOYSTICK_DIRECTION_RIGHT ? 1 : 0);
+/** \brief  Get handler for mapping
+ *
+ * Select handler for the action type of \a mapping once, when compiling the
+ * dispatch program, instead of on every event.
+ *
+ * \param[in]   mapping mapping
+ * \param[in]   value   value that will be passed to the handler
+ *
+ * \return  handler or \c NULL when applying \a value to \a mapping is a no-op
+ */
+static perform_func_t mapping_handler(const joy_mapping_t *mapping, int32_t value)
+{
+    switch (mapping->action) {
+        case JOY_ACTION_JOYSTICK:
+            return perform_pin;
+        case JOY_ACTION_KEYBOARD:     /* fall through */
+        case JOY_ACTION_POT_AXIS:     /* fall through */
+        case JOY_ACTION_UI_ACTIVATE:
+            return perform_queue;
+        case JOY_ACTION_UI_ACTION:
+            /* UI actions are only triggered on press */
+            return value ? perform_queue : NULL;
+        default:
+            /* JOY_ACTION_NONE: ignore input */
+            return NULL;
     }
-
-    hat->prev = value;
 }
 
-
-/** \brief  Open joystick device for polling
+/** \brief  Determine if mapping does anything when pressed or released
  *
- * \param[in]   joydev  joystick device
+ * \param[in]   mapping mapping
  *
- * \return  \c true on success
+ * \return  \c true if \a mapping requires operations in the dispatch program
  */
-bool joy_open(joy_device_t *joydev)
+static bool mapping_is_active(const joy_mapping_t *mapping)
 {
-    bool result;
+    return (bool)(mapping_handler(mapping, 1) != NULL ||
+                  mapping_handler(mapping, 0) != NULL);
+}
 
-    msg_debug("called\n");
+/** \brief  Append operation to dispatch program
+ *
+ * \param[in]       program dispatch program
+ * \param[in,out]   size    number of operations allocated in \a program
+ * \param[in]       mapping mapping to apply
+ * \param[in]       value   value to apply
+ */
+static void program_emit(joy_program_t       *program,
+                         uint32_t            *size,
+                         const joy_mapping_t *mapping,
+                         int32_t              value)
+{
+    perform_func_t     perform = mapping_handler(mapping, value);
+    joy_dispatch_op_t *op;
 
-    if (joydev == NULL) {
+    if (perform == NULL) {
+        return;
+    }
+    if (program->num_ops == *size) {
+        *size *= 2u;
+        program->ops = lib_realloc(program->ops, *size * sizeof *(program->ops));
+    }
+    op = &(program->ops[program->num_ops++]);
+    op->perform = perform;
+    op->mapping = mapping;
+    op->value   = value;
+}
+
+/** \brief  Get axis mapping for axis state
+ *
+ * \param[in]   axis    axis
+ * \param[in]   state   axis state (0 = negative, 1 = centered, 2 = positive)
+ *
+ * \return  mapping or \c NULL for the centered state
+ */
+static const joy_mapping_t *axis_state_mapping(const joy_axis_t *axis, uint32_t state)
+{
+    if (state == 0) {
+        return &(axis->mapping.negative);
+    } else if (state == 2) {
+        return &(axis->mapping.positive);
+    }
+    return NULL;
+}
+
+/** \brief  Get state of axis for the dispatch program
+ *
+ * \param[in]   value   axis value
+ *
+ * \return  0 for negative, 1 for centered and 2 for positive values
+ */
+static inline uint32_t axis_state(int32_t value)
+{
+    return (uint32_t)((value > 0) - (value < 0) + 1);
+}
+
+/** \brief  Compile the mappings of a device into a dispatch program
+ *
+ * Translate the mappings of all inputs of \a joydev into a table of
+ * transitions indexed by (previous state, new state) of each input, each
+ * transition listing the emulated pin, key or action operations to apply.
+ * Inputs without mappings don't get any transitions.
+ *
+ * Must be called again after changing mappings, which \c joymap_load() does.
+ * The event handlers compile the program on first use if required.
+ *
+ * \param[in]   joydev  joystick device
+ */
+void joy_device_compile_mappings(joy_device_t *joydev)
+{
+    joy_program_t *program = &(joydev->program);
+    uint32_t       size    = 16u;
+    uint32_t       num     = 0;
+    uint32_t       t;
+    uint32_t       i;
+
+    program_free(program);
+
+    /* assign blocks of transitions to inputs that have active mappings */
+    for (i = 0; i < joydev->num_axes; i++) {
+        joy_axis_t *axis = &(joydev->axes[i]);
+
+        if (mapping_is_active(&axis->mapping.negative) ||
+                mapping_is_active(&axis->mapping.positive)) {
+            axis->transitions = num;
+            num += JOY_AXIS_NUM_STATES * JOY_AXIS_NUM_STATES;
+        } else {
+            axis->transitions = JOY_TRANSITIONS_NONE;
+        }
+    }
+    for (i = 0; i < joydev->num_buttons; i++) {
+        joy_button_t *button = &(joydev->buttons[i]);
+
+        if (mapping_is_active(&button->mapping)) {
+            button->transitions = num;
+            num += JOY_BUTTON_NUM_STATES * JOY_BUTTON_NUM_STATES;
+        } else {
+            button->transitions = JOY_TRANSITIONS_NONE;
+        }
+    }
+    for (i = 0; i < joydev->num_hats; i++) {
+        joy_hat_t *hat = &(joydev->hats[i]);
+
+        if (mapping_is_active(&hat->mapping.up)   ||
+                mapping_is_active(&hat->mapping.down) ||
+                mapping_is_active(&hat->mapping.left) ||
+                mapping_is_active(&hat->mapping.right)) {
+            hat->transitions = num;
+            num += JOY_HAT_NUM_STATES * JOY_HAT_NUM_STATES;
+        } else {
+            hat->transitions = JOY_TRANSITIONS_NONE;
+        }
+    }
+
+    program->num_transitions = num;
+    program->first           = lib_malloc((num + 1u) * sizeof *(program->first));
+    program->ops             = lib_malloc(size * sizeof *(program->ops));
+
+    /* emit operations, in the same order the transitions were assigned */
+    t = 0;
+    for (i = 0; i < joydev->num_axes; i++) {
+        const joy_axis_t *axis = &(joydev->axes[i]);
+
+        if (axis->transitions == JOY_TRANSITIONS_NONE) {
+            continue;
+        }
+        for (uint32_t prev = 0; prev < JOY_AXIS_NUM_STATES; prev++) {
+            for (uint32_t next = 0; next < JOY_AXIS_NUM_STATES; next++) {
+                program->first[t++] = program->num_ops;
+                if (prev == next) {
+                    continue;
+                }
+                /* release directions first */
+                if (axis_state_mapping(axis, prev) != NULL) {
+                    program_emit(program, &size, axis_state_mapping(axis, prev), 0);
+                }
+                if (axis_state_mapping(axis, next) != NULL) {
+                    program_emit(program, &size, axis_state_mapping(axis, next), 1);
+                }
+            }
+        }
+    }
+    for (i = 0; i < joydev->num_buttons; i++) {
+        const joy_button_t *button = &(joydev->buttons[i]);
+
+        if (button->transitions == JOY_TRANSITIONS_NONE) {
+            continue;
+        }
+        for (uint32_t prev = 0; prev < JOY_BUTTON_NUM_STATES; prev++) {
+            for (uint32_t next = 0; next < JOY_BUTTON_NUM_STATES; next++) {
+                program->first[t++] = program->num_ops;
+                if (prev != next) {
+                    program_emit(program, &size, &(button->mapping), (int32_t)next);
+                }
+            }
+        }
+    }
+    for (i = 0; i < joydev->num_hats; i++) {
+        const joy_hat_t     *hat = &(joydev->hats[i]);
+        const joy_mapping_t *directions[4];
+
+        if (hat->transitions == JOY_TRANSITIONS_NONE) {
+            continue;
+        }
+        /* same order as the JOYSTICK_DIRECTION_* bits */
+        directions[0] = &(hat->mapping.up);
+        directions[1] = &(hat->mapping.down);
+        directions[2] = &(hat->mapping.left);
+        directions[3] = &(hat->mapping.right);
+
+        for (uint32_t prev = 0; prev < JOY_HAT_NUM_STATES; prev++) {
+            for (uint32_t next = 0; next < JOY_HAT_NUM_STATES; next++) {
+                program->first[t++] = program->num_ops;
+                for (uint32_t d = 0; d < 4u; d++) {
+                    uint32_t bit = 1u << d;
+
+                    if ((prev & bit) != (next & bit)) {
+                        program_emit(program, &size, directions[d],
+                                     (next & bit) ? 1 : 0);
+                    }
+                }
+            }
+        }
+    }
+    program->first[t] = program->num_ops;
+
+    msg_debug("compiled %"PRIu32" transitions, %"PRIu32" operations\n",
+              program->num_transitions, program->num_ops);
+}
+
+/** \brief  Run transition of dispatch program
+ *
+ * \param[in]   joydev      joystick device
+ * \param[in]   transitions first transition of the input
+ * \param[in]   offset      transition offset: prev state * states + new state
+ */
+static inline void program_run(joy_device_t *joydev,
+                               uint32_t      transitions,
+                               uint32_t      offset)
+{
+    const joy_program_t *program = &(joydev->program);
+    uint32_t             t;
+    uint32_t             end;
+
+    if (transitions == JOY_TRANSITIONS_NONE) {
+        return;
+    }
+    t   = program->first[transitions + offset];
+    end = program->first[transitions + offset + 1u];
+    for (; t < end; t++) {
+        const joy_dispatch_op_t *op = &(program->ops[t]);
+
+        op->perform(joydev, op->mapping, op->value);
+    }
+}
+
+/** \brief  Make sure the dispatch program of a device is compiled
+ *
+ * \param[in]   joydev  joystick device
+ */
+static inline void program_check(joy_device_t *joydev)
+{
+    if (joydev->program.first == NULL) {
+        joy_device_compile_mappings(joydev);
+    }
+}
+
+
+/** \brief  Apply new axis value
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   axis    axis
+ * \param[in]   value   axis value
+ */
+static inline void axis_apply(joy_device_t *joydev, joy_axis_t *axis, int32_t value)
+{
+    uint32_t prev = axis_state(axis->prev);
+    uint32_t next = axis_state(value);
+
+    if (next != prev) {
+        program_run(joydev, axis->transitions, prev * JOY_AXIS_NUM_STATES + next);
+        axis->prev = (int32_t)next - 1;
+    }
+}
+
+/** \brief  Apply new button value
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   button  button
+ * \param[in]   value   button value
+ */
+static inline void button_apply(joy_device_t *joydev, joy_button_t *button, int32_t value)
+{
+    uint32_t prev = button->prev != 0 ? 1u : 0u;
+    uint32_t next = value != 0 ? 1u : 0u;
+
+    if (next != prev) {
+        program_run(joydev, button->transitions, prev * JOY_BUTTON_NUM_STATES + next);
+        button->prev = (int32_t)next;
+    }
+}
+
+/** \brief  Apply new hat value
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   hat     hat
+ * \param[in]   value   hat value (joystick pins bitmask)
+ */
+static inline void hat_apply(joy_device_t *joydev, joy_hat_t *hat, int32_t value)
+{
+    uint32_t prev = (uint32_t)hat->prev & (JOY_HAT_NUM_STATES - 1u);
+    uint32_t next = (uint32_t)value     & (JOY_HAT_NUM_STATES - 1u);
+
+    if (next != prev) {
+        program_run(joydev, hat->transitions, prev * JOY_HAT_NUM_STATES + next);
+        hat->prev = (int32_t)next;
+    }
+}
+
+
+/** \brief  Joystick axis event
+ *
+ * \param[in]   joydev  joystick device triggering the event
+ * \param[in]   axis    axis object
+ * \param[in]   value   axis value
+ */
+void joy_axis_event(joy_device_t *joydev, joy_axis_t *axis, joystick_axis_value_t value)
+{
+    if (axis == NULL) {
+        msg_error("`axis` is NULL\n");
+        return;
+    }
+
+    msg_verbose("axis event: %s: %s (%"PRIx16"), value: %"PRId32"\n",
+                joydev->name, axis->name, axis->code, value);
+
+    program_check(joydev);
+    joydev->timestamp = 0;
+    axis_apply(joydev, axis, (int32_t)value);
+}
+
+
+/** \brief  Joystick button event
+ *
+ * \param[in]   joydev  joystick device triggering the event
+ * \param[in]   button  button object
+ * \param[in]   value   button value
+ */
+void joy_button_event(joy_device_t *joydev, joy_button_t *button, int32_t value)
+{
+    if (button == NULL) {
+        msg_error("error: `button` is NULL\n");
+        return;
+    }
+
+    msg_verbose("button event: %s: %s (%"PRIx16"), value: %"PRId32"\n",
+                joydev->name, button->name, button->code, value);
+
+    program_check(joydev);
+    joydev->timestamp = 0;
+    button_apply(joydev, button, value);
+}
+
+
+/** \brief  Joystick hat event
+ *
+ * \param[in]   joydev  joystick device triggering the event
+ * \param[in]   hat     hat object
+ * \param[in]   value   hat value (joystick pins bitmask)
+ */
+void joy_hat_event(joy_device_t  *joydev,
+                   joy_hat_t     *hat,
+                   int32_t        value)
+{
+    if (hat == NULL) {
+        msg_error("`hat` is NULL\n");
+        return;
+    }
+
+    if ((hat->prev & 0x0f) != (value & 0x0f)) {
+        msg_verbose("hat event: %s: %s (%"PRIx16"), value: %"PRId32": %s\n",
+                    joydev->name, hat->name, hat->code, value,
+                    joy_direction_name((uint32_t)value));
+    }
+
+    program_check(joydev);
+    joydev->timestamp = 0;
+    hat_apply(joydev, hat, value);
+}
+
+
+/** \brief  Log event of a batch
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   event   event
+ */
+static void event_log(const joy_device_t *joydev, const joy_event_t *event)
+{
+    switch (event->type) {
+        case JOY_INPUT_AXIS:
+            printf("axis event: %s: %s (%"PRIx16"), value: %"PRId32"\n",
+                   joydev->name, event->input.axis->name,
+                   event->input.axis->code, event->value);
+            break;
+        case JOY_INPUT_BUTTON:
+            printf("button event: %s: %s (%"PRIx16"), value: %"PRId32"\n",
+                   joydev->name, event->input.button->name,
+                   event->input.button->code, event->value);
+            break;
+        case JOY_INPUT_HAT:
+            printf("hat event: %s: %s (%"PRIx16"), value: %"PRId32": %s\n",
+                   joydev->name, event->input.hat->name,
+                   event->input.hat->code, event->value,
+                   joy_direction_name((uint32_t)event->value));
+            break;
+        default:
+            break;
+    }
+}
+
+/** \brief  Dispatch list of events of a device
+ *
+ * \param[in]   joydev  joystick device triggering the events
+ * \param[in]   events  list of events, in the order they occurred
+ * \param[in]   count   number of elements in \a events
+ */
+static void events_dispatch(joy_device_t *joydev, const joy_event_t *events, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        const joy_event_t *event = &(events[i]);
+
+        if (verbose) {
+            event_log(joydev, event);
+        }
+        joydev->timestamp = event->timestamp;
+        switch (event->type) {
+            case JOY_INPUT_AXIS:
+                axis_apply(joydev, event->input.axis, event->value);
+                break;
+            case JOY_INPUT_BUTTON:
+                button_apply(joydev, event->input.button, event->value);
+                break;
+            case JOY_INPUT_HAT:
+                hat_apply(joydev, event->input.hat, event->value);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/** \brief  Process list of events of a device
+ *
+ * Process events gathered by a driver during a single poll in one go. Unlike
+ * the single event functions the inputs in \a events are not checked for
+ * \c NULL, the \c joy_event_batch_*() functions make sure they aren't.
+ *
+ * Emulated joystick pins are updated per event, so a button pressed and
+ * released again in the same poll still results in two port updates.
+ *
+ * \param[in]   joydev  joystick device triggering the events
+ * \param[in]   events  list of events, in the order they occurred
+ * \param[in]   count   number of elements in \a events
+ */
+void joy_events_submit(joy_device_t *joydev, const joy_event_t *events, size_t count)
+{
+    if (joydev == NULL || count == 0) {
+        return;
+    }
+
+    program_check(joydev);
+    events_dispatch(joydev, events, count);
+}
+
+/** \brief  Process frame of events of a device
+ *
+ * Like \c joy_events_submit(), but for a single frame of events reported by
+ * the device, for example the events up to an evdev \c SYN_REPORT. Changes of
+ * emulated joystick pins are published once all events have been processed,
+ * see \c frame.
+ *
+ * Only use this for events the device reported as happening at the same time,
+ * pins set and cleared again within \a events don't produce port updates.
+ *
+ * \param[in]   joydev  joystick device triggering the events
+ * \param[in]   events  list of events, in the order they occurred
+ * \param[in]   count   number of elements in \a events
+ */
+void joy_frame_submit(joy_device_t *joydev, const joy_event_t *events, size_t count)
+{
+    if (joydev == NULL || count == 0) {
+        return;
+    }
+
+    program_check(joydev);
+    frame_begin();
+    events_dispatch(joydev, events, count);
+    frame_end();
+}
+
+
+/** \brief  Initialize event batch for device
+ *
+ * \param[in]   batch   event batch
+ * \param[in]   joydev  joystick device
+ * \param[in]   framed  each flush of the batch submits a single frame of
+ *                      events reported by the device
+ */
+void joy_event_batch_init(joy_event_batch_t *batch, joy_device_t *joydev, bool framed)
+{
+    batch->joydev = joydev;
+    batch->count  = 0;
+    batch->frame  = framed;
+}
+
+/** \brief  Submit events in batch and empty the batch
+ *
+ * \param[in]   batch   event batch
+ */
+void joy_event_batch_flush(joy_event_batch_t *batch)
+{
+    if (batch->frame) {
+        joy_frame_submit(batch->joydev, batch->events, batch->count);
+    } else {
+        joy_events_submit(batch->joydev, batch->events, batch->count);
+    }
+    batch->count = 0;
+}
+
+/** \brief  Append event to batch
+ *
+ * Submits the batch first when it is full.
+ *
+ * \param[in]   batch   event batch
+ *
+ * \return  event to fill in
+ */
+static inline joy_event_t *event_batch_next(joy_event_batch_t *batch)
+{
+    if (batch->count == JOY_EVENT_BATCH_SIZE) {
+        joy_event_batch_flush(batch);
+    }
+    return &(batch->events[batch->count++]);
+}
+
+/** \brief  Add axis event to batch
+ *
+ * \param[in]   batch       event batch
+ * \param[in]   axis        axis (ignored when \c NULL)
+ * \param[in]   value       axis value
+ * \param[in]   timestamp   time of event in microseconds (0 = unknown)
+ */
+void joy_event_batch_axis(joy_event_batch_t     *batch,
+                          joy_axis_t            *axis,
+                          joystick_axis_value_t  value,
+                          uint64_t               timestamp)
+{
+    joy_event_t *event;
+
+    if (axis != NULL) {
+        event = event_batch_next(batch);
+        event->type       = JOY_INPUT_AXIS;
+        event->input.axis = axis;
+        event->value      = (int32_t)value;
+        event->timestamp  = timestamp;
+    }
+}
+
+/** \brief  Add button event to batch
+ *
+ * \param[in]   batch       event batch
+ * \param[in]   button      button (ignored when \c NULL)
+ * \param[in]   value       button value
+ * \param[in]   timestamp   time of event in microseconds (0 = unknown)
+ */
+void joy_event_batch_button(joy_event_batch_t *batch,
+                            joy_button_t      *button,
+                            int32_t            value,
+                            uint64_t           timestamp)
+{
+    joy_event_t *event;
+
+    if (button != NULL) {
+        event = event_batch_next(batch);
+        event->type         = JOY_INPUT_BUTTON;
+        event->input.button = button;
+        event->value        = value;
+        event->timestamp    = timestamp;
+    }
+}
+
+/** \brief  Add hat event to batch
+ *
+ * \param[in]   batch       event batch
+ * \param[in]   hat         hat (ignored when \c NULL)
+ * \param[in]   value       hat value (joystick pins bitmask)
+ * \param[in]   timestamp   time of event in microseconds (0 = unknown)
+ */
+void joy_event_batch_hat(joy_event_batch_t *batch,
+                         joy_hat_t         *hat,
+                         int32_t            value,
+                         uint64_t           timestamp)
+{
+    joy_event_t *event;
+
+    if (hat != NULL) {
+        event = event_batch_next(batch);
+        event->type      = JOY_INPUT_HAT;
+        event->input.hat = hat;
+        event->value     = value;
+        event->timestamp = timestamp;
+    }
+}
+
+
+/** \brief  Open joystick device for polling
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c true on success
+ */
+bool joy_open(joy_device_t *joydev)
+{
+    bool result;
+
+    msg_debug("called\n");
+
+    if (joydev == NULL) {
         msg_error("`joydev` is NULL\n");
         return false;
     }
@@ -797,6 +1794,78 @@ uint32_t joy_device_set_capabilities(joy_device_t *joydev)
 }
 
 
+/** \brief  Build lookup tables for finding inputs by code and by name
+ *
+ * Create tables indexed by event code for the axes, buttons and hats of
+ * \a joydev, so the \c joy_*_from_code() functions can find an input in
+ * constant time, and hash tables for the \c joy_*_from_name() functions used
+ * by the joymap parser. Must be called again when the inputs of the device
+ * change.
+ *
+ * \param[in]   joydev  joystick device
+ */
+void joy_device_build_index(joy_device_t *joydev)
+{
+    uint16_t    *codes;
+    const char **names;
+    uint32_t     count;
+    uint32_t     i;
+
+    /* scratch lists large enough for the inputs of each type */
+    count = joydev->num_axes + joydev->num_buttons + joydev->num_hats + 1u;
+    codes = lib_malloc(count * sizeof *codes);
+    names = lib_malloc(count * sizeof *names);
+
+    for (i = 0; i < joydev->num_axes; i++) {
+        codes[i] = joydev->axes[i].code;
+        names[i] = joydev->axes[i].name;
+    }
+    code_index_build(&joydev->axis_index, codes, joydev->num_axes);
+    name_index_build(&joydev->axis_names, names, joydev->num_axes);
+
+    for (i = 0; i < joydev->num_buttons; i++) {
+        codes[i] = joydev->buttons[i].code;
+        names[i] = joydev->buttons[i].name;
+    }
+    code_index_build(&joydev->button_index, codes, joydev->num_buttons);
+    name_index_build(&joydev->button_names, names, joydev->num_buttons);
+
+    for (i = 0; i < joydev->num_hats; i++) {
+        codes[i] = joydev->hats[i].code;
+        names[i] = joydev->hats[i].name;
+    }
+    code_index_build(&joydev->hat_index, codes, joydev->num_hats);
+    name_index_build(&joydev->hat_names, names, joydev->num_hats);
+
+    lib_free(codes);
+    lib_free(names);
+}
+
+
+/** \brief  Prepare device created by the driver for use
+ *
+ * \param[in]   joydev  joystick device
+ */
+static void device_setup(joy_device_t *joydev)
+{
+    if (joy_device_set_capabilities(joydev) == JOY_CAPS_NONE) {
+        msg_debug("TODO: insufficient capabilities: reject device\n");
+    }
+
+    /* right-trim device name */
+    lib_strrtrim(joydev->name);
+
+    /* index inputs by event code and name for the event handlers and
+     * the joymap parser */
+    joy_device_build_index(joydev);
+
+    /* create default mapping */
+    /* TODO: perhaps reject if no proper mapping can be created? */
+    joy_arch_device_create_default_mapping(joydev);
+    joy_device_compile_mappings(joydev);
+}
+
+
 /** \brief  Scan connected host devices and generate list of usable devices
  *
  * Generate list of host devices that can function as input devices for VICE.
@@ -818,20 +1887,225 @@ int joy_device_list_init(joy_device_t ***devices)
         return count;
     }
     for (int i = 0; i < count; i++) {
-        joy_device_t *joydev = (*devices)[i];
+        device_setup((*devices)[i]);
+    }
+    return count;
+}
+
+
+/** \brief  Add device to device list
+ *
+ * Add a single device, for example one that was just plugged in, without
+ * rescanning all devices.
+ *
+ * \param[in,out]   devices device list (can be reallocated)
+ * \param[in]       joydev  device created by the driver
+ *
+ * \return  number of devices in \a devices
+ */
+int joy_device_list_add(joy_device_t ***devices, joy_device_t *joydev)
+{
+    joy_device_t **list  = *devices;
+    size_t         count = 0;
 
-        if (joy_device_set_capabilities(joydev) == JOY_CAPS_NONE) {
-            msg_debug("TODO: insufficient capabilities: reject device\n");
+    if (list != NULL) {
+        while (list[count] != NULL) {
+            count++;
         }
+    }
+    device_setup(joydev);
+    list = lib_realloc(list, (count + 2u) * sizeof *list);
+    list[count++] = joydev;
+    list[count]   = NULL;
+    *devices = list;
+    return (int)count;
+}
 
-        /* right-trim device name */
-        lib_strrtrim(joydev->name);
 
-        /* create default mapping */
-        /* TODO: perhaps reject if no proper mapping can be created? */
-        joy_arch_device_create_default_mapping(joydev);
+/** \brief  Let the driver do housekeeping for the device list
+ *
+ * Releases resources held for devices that aren't polled, for example file
+ * descriptors kept open after probing for longer than the driver allows.
+ * Call periodically, from the thread that opens and closes devices.
+ *
+ * \param[in]   devices device list
+ */
+void joy_device_list_idle(joy_device_t **devices)
+{
+    if (driver.idle != NULL) {
+        driver.idle(devices);
     }
-    return count;
+}
+
+
+/** \brief  Remove device from device list and free it
+ *
+ * \param[in,out]   devices device list
+ * \param[in]       joydev  device to remove
+ *
+ * \return  number of devices in \a devices
+ */
+int joy_device_list_remove(joy_device_t ***devices, joy_device_t *joydev)
+{
+    joy_device_t **list  = *devices;
+    size_t         count = 0;
+
+    if (list == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; list[i] != NULL; i++) {
+        if (list[i] == joydev) {
+            joy_device_free(joydev);
+        } else {
+            list[count++] = list[i];
+        }
+    }
+    list[count] = NULL;
+    return (int)count;
+}
+
+
+/** \brief  Start watching for devices being plugged in or removed
+ *
+ * \return  \c false on error or if the driver doesn't support hotplugging
+ */
+bool joy_hotplug_start(void)
+{
+    if (driver.hotplug_start == NULL) {
+        msg_error("driver doesn't support hotplugging\n");
+        return false;
+    }
+    return driver.hotplug_start();
+}
+
+
+/** \brief  Stop watching for devices being plugged in or removed
+ */
+void joy_hotplug_stop(void)
+{
+    if (driver.hotplug_stop != NULL) {
+        driver.hotplug_stop();
+    }
+}
+
+
+/** \brief  Update device list with devices plugged in or removed
+ *
+ * Handle pending hotplug events without blocking, adding and removing single
+ * devices in \a devices. Devices that are still open are not removed: their
+ * removal is detected when polling them, after which they should be closed so
+ * a next call can remove them.
+ *
+ * \param[in,out]   devices     device list (can be reallocated)
+ * \param[in]       callback    function called for each device added or
+ *                              removed (can be \c NULL)
+ *
+ * \return  number of devices in \a devices or -1 on error
+ */
+int joy_hotplug_poll(joy_device_t ***devices, joy_hotplug_func_t callback)
+{
+    if (driver.hotplug_poll == NULL) {
+        return -1;
+    }
+    return driver.hotplug_poll(devices, callback);
+}
+
+
+/** \brief  Get time for event timestamps
+ *
+ * Drivers are expected to convert the timestamps of host events to this clock.
+ *
+ * \return  monotonic time in microseconds
+ */
+uint64_t joy_time_us(void)
+{
+#ifdef WINDOWS_COMPILE
+    LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)((double)count.QuadPart * 1e6 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+#endif
+}
+
+
+/** \brief  Start polling devices in a separate input thread
+ *
+ * Let the driver poll \a devices in its own thread, waking up only when a
+ * device has new events, instead of calling \c joy_poll() at intervals.
+ * The devices must have been opened with \c joy_open().
+ *
+ * \param[in]   devices list of devices
+ * \param[in]   count   number of devices in \a devices
+ *
+ * \return  \c false on error or if the driver doesn't support an input thread
+ */
+bool joy_thread_start(joy_device_t **devices, size_t count)
+{
+    if (driver.thread_start == NULL) {
+        msg_error("driver doesn't support an input thread\n");
+        return false;
+    }
+    return driver.thread_start(devices, count);
+}
+
+
+/** \brief  Stop input thread
+ *
+ * Blocks until the input thread has exited.
+ */
+void joy_thread_stop(void)
+{
+    if (driver.thread_stop != NULL) {
+        driver.thread_stop();
+    }
+}
+
+
+/** \brief  Check if input thread is still polling devices
+ *
+ * The input thread keeps running when all its devices failed or were removed,
+ * it only exits by itself on errors.
+ *
+ * \return  \c true if the input thread is running
+ */
+bool joy_thread_active(void)
+{
+    return driver.thread_active != NULL ? driver.thread_active() : false;
+}
+
+
+/** \brief  Add device to running input thread
+ *
+ * \param[in]   joydev  opened joystick device
+ *
+ * \return  \c false on error or if the input thread isn't running
+ */
+bool joy_thread_add(joy_device_t *joydev)
+{
+    return driver.thread_add != NULL ? driver.thread_add(joydev) : false;
+}
+
+
+/** \brief  Check if the input thread stopped polling a device
+ *
+ * Devices that fail while being polled by the input thread, for example
+ * because they were unplugged, are no longer polled but remain open. The
+ * caller should close them with \c joy_close().
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c true if \a joydev failed and is no longer polled
+ */
+bool joy_thread_lost(joy_device_t *joydev)
+{
+    return driver.thread_lost != NULL ? driver.thread_lost(joydev) : false;
 }
 
 
@@ -843,7 +2117,8 @@ int joy_device_list_init(joy_device_t ***devices)
  */
 bool joy_init(void)
 {
-    /* just this for now */
+    joy_queue_init(&port_queue);
+    memset(port_state, 0, sizeof port_state);
     return joy_arch_init();
 }
 
@@ -857,3 +2132,35 @@ void joy_shutdown(void)
 {
     joy_arch_shutdown();
 }
+
+
+/** \brief  Get queue of emulated port updates
+ *
+ * The updates produced by the mappings of all devices are pushed onto this
+ * queue, the emulation thread is expected to drain it regularly with
+ * \c joy_queue_drain().
+ *
+ * \return  port update queue
+ */
+joy_queue_t *joy_port_queue(void)
+{
+    return &port_queue;
+}
+
+
+/** \brief  Get state of emulated joystick port
+ *
+ * Can be called from any thread at any time, without taking a lock.
+ *
+ * \param[in]   port    port number (0-based)
+ *
+ * \return  bitmask of JOYSTICK_DIRECTION_* and JOYSTICK_BUTTON_* pins active
+ *          on \a port, 0 for an invalid port
+ */
+uint32_t joy_port_read(int port)
+{
+    if (port < 0 || port >= JOY_NUM_PORTS) {
+        return 0;
+    }
+    return __atomic_load_n(&port_state[port], __ATOMIC_ACQUIRE);
+}
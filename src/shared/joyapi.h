@@ -10,6 +10,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "joyapi-types.h"
+#include "joyqueue.h"
 
 /*
  * Prototypes mark 'arch' are expected to be implemented for the arch using
@@ -25,9 +26,25 @@ bool          joy_arch_device_create_default_mapping(joy_device_t *joydev);
 
 bool          joy_init(void);
 void          joy_shutdown(void);
+joy_queue_t  *joy_port_queue(void);
+uint32_t      joy_port_read(int port);
+uint64_t      joy_time_us(void);
+
+bool          joy_thread_start (joy_device_t **devices, size_t count);
+void          joy_thread_stop  (void);
+bool          joy_thread_active(void);
+bool          joy_thread_add   (joy_device_t *joydev);
+bool          joy_thread_lost  (joy_device_t *joydev);
+
+bool          joy_hotplug_start(void);
+void          joy_hotplug_stop (void);
+int           joy_hotplug_poll (joy_device_t ***devices, joy_hotplug_func_t callback);
 
 void          joy_driver_register(const joy_driver_t *drv);
 int           joy_device_list_init     (joy_device_t ***devices);
+int           joy_device_list_add      (joy_device_t ***devices, joy_device_t *joydev);
+int           joy_device_list_remove   (joy_device_t ***devices, joy_device_t *joydev);
+void          joy_device_list_idle     (joy_device_t  **devices);
 
 void          joy_device_list_free(joy_device_t  **devices);
 
@@ -36,6 +53,8 @@ void          joy_device_free(joy_device_t *dev);
 void          joy_device_dump(const joy_device_t *dev);
 joy_device_t *joy_device_get(joy_device_t **devices, const char *node);
 uint32_t      joy_device_set_capabilities(joy_device_t *joydev);
+void          joy_device_build_index(joy_device_t *joydev);
+void          joy_device_compile_mappings(joy_device_t *joydev);
 
 const char   *joy_device_get_button_name(const joy_device_t *joydev, uint16_t code);
 const char   *joy_device_get_axis_name  (const joy_device_t *joydev, uint16_t code);
@@ -47,12 +66,15 @@ void          joy_axis_init       (joy_axis_t        *axis);
 void          joy_button_init     (joy_button_t      *button);
 void          joy_hat_init        (joy_hat_t         *hat);
 
-joy_axis_t   *joy_axis_from_code  (joy_device_t *joydev, uint16_t code);
-joy_axis_t   *joy_axis_from_name  (joy_device_t *joydev, const char *name);
-joy_button_t *joy_button_from_code(joy_device_t *joydev, uint16_t code);
-joy_button_t *joy_button_from_name(joy_device_t *joydev, const char *name);
-joy_hat_t    *joy_hat_from_code   (joy_device_t *joydev, uint16_t code);
-joy_hat_t    *joy_hat_from_name   (joy_device_t *joydev, const char *name);
+joy_axis_t   *joy_axis_from_code      (joy_device_t *joydev, uint16_t code);
+joy_axis_t   *joy_axis_from_name      (joy_device_t *joydev, const char *name);
+joy_axis_t   *joy_axis_from_name_len  (joy_device_t *joydev, const char *name, size_t len);
+joy_button_t *joy_button_from_code    (joy_device_t *joydev, uint16_t code);
+joy_button_t *joy_button_from_name    (joy_device_t *joydev, const char *name);
+joy_button_t *joy_button_from_name_len(joy_device_t *joydev, const char *name, size_t len);
+joy_hat_t    *joy_hat_from_code       (joy_device_t *joydev, uint16_t code);
+joy_hat_t    *joy_hat_from_name       (joy_device_t *joydev, const char *name);
+joy_hat_t    *joy_hat_from_name_len   (joy_device_t *joydev, const char *name, size_t len);
 
 joystick_axis_value_t joy_axis_value_from_hwdata(joy_axis_t *axis, int32_t hw_value);
 void          joy_axis_auto_calibrate(joy_axis_t *axis);
@@ -60,6 +82,17 @@ void          joy_axis_auto_calibrate(joy_axis_t *axis);
 void          joy_axis_event  (joy_device_t *joydev, joy_axis_t *axis, joystick_axis_value_t value);
 void          joy_button_event(joy_device_t *joydev, joy_button_t *button, int32_t value);
 void          joy_hat_event   (joy_device_t *joydev, joy_hat_t *hat, int32_t value);
+void          joy_events_submit(joy_device_t *joydev, const joy_event_t *events, size_t count);
+void          joy_frame_submit (joy_device_t *joydev, const joy_event_t *events, size_t count);
+
+void          joy_event_batch_init  (joy_event_batch_t *batch, joy_device_t *joydev, bool framed);
+void          joy_event_batch_flush (joy_event_batch_t *batch);
+void          joy_event_batch_axis  (joy_event_batch_t *batch, joy_axis_t *axis,
+                                     joystick_axis_value_t value, uint64_t timestamp);
+void          joy_event_batch_button(joy_event_batch_t *batch, joy_button_t *button,
+                                     int32_t value, uint64_t timestamp);
+void          joy_event_batch_hat   (joy_event_batch_t *batch, joy_hat_t *hat,
+                                     int32_t value, uint64_t timestamp);
 
 bool          joy_open (joy_device_t *joydev);
 bool          joy_poll (joy_device_t *joydev);
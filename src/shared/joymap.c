@@ -25,7 +25,7 @@
 
 #define VJM_COMMENT '#'
 
-#define LINEBUF_INITIAL_SIZE    256
+#define DATABUF_INITIAL_SIZE    4096
 
 /** \brief  VJM keyword IDs
  *
@@ -66,10 +66,12 @@ typedef enum {
 
 /** \brief  Parser state object */
 typedef struct pstate_s {
-    FILE       *fp;         /**< file pointer during parsing */
     const char *path;       /**< current path to vjm file */
-    char       *buffer;     /**< buffer for reading lines from file */
-    size_t      bufsize;    /**< number of bytes allocated for \c buffer */
+    char       *data;       /**< contents of vjm file */
+    size_t      datasize;   /**< number of bytes allocated for \c data */
+    size_t      datalen;    /**< number of bytes in \c data */
+    char       *next;       /**< start of next line in \c data */
+    char       *buffer;     /**< current line in \c data */
     size_t      buflen;     /**< string length of \c buffer */
     int         linenum;    /**< line number in vjm file */
     char       *curpos;     /**< current position in buffer */
@@ -77,6 +79,18 @@ typedef struct pstate_s {
 } pstate_t;
 
 
+/** \brief  Token in the line buffer
+ *
+ * Points into the parser's line buffer, so it is only valid until the next
+ * line is read. The token isn't nul-terminated, use \c "%.*s" with
+ * \c (int)len to print it.
+ */
+typedef struct token_s {
+    const char *str;    /**< start of token */
+    size_t      len;    /**< length of token */
+} token_t;
+
+
 /* forward declarations */
 static void parser_log_warning(const char *fmt, ...);
 static void parser_log_error  (const char *fmt, ...);
@@ -131,17 +145,19 @@ static pstate_t pstate;
 
 /** \brief  Initialize parser state
  *
- * Initialize parser for use, allocating an initial buffer for reading lines
- * from a file.
+ * Initialize parser for use, allocating an initial buffer for reading files.
+ * The buffer is reused for subsequent files, growing when required.
  */
 static void pstate_init(void)
 {
-    pstate.fp        = NULL;
     pstate.path      = NULL;
-    pstate.bufsize   = LINEBUF_INITIAL_SIZE;
+    pstate.datasize  = DATABUF_INITIAL_SIZE;
+    pstate.datalen   = 0;
+    pstate.data      = lib_malloc(pstate.datasize);
+    pstate.data[0]   = '\0';
+    pstate.next      = pstate.data;
+    pstate.buffer    = pstate.data;
     pstate.buflen    = 0;
-    pstate.buffer    = lib_malloc(pstate.bufsize);
-    pstate.buffer[0] = '\0';
     pstate.curpos    = pstate.buffer;
     pstate.prevpos   = pstate.buffer;
     pstate.linenum   = -1;
@@ -150,10 +166,9 @@ static void pstate_init(void)
 /** \brief  Clean up resources used by the parser state */
 static void pstate_free(void)
 {
-    if (pstate.fp != NULL) {
-        fclose(pstate.fp);
-    }
-    lib_free(pstate.buffer);
+    lib_free(pstate.data);
+    pstate.data   = NULL;
+    pstate.buffer = NULL;
 }
 
 /** \brief  Skip whitespace in the buffer to the next token */
@@ -403,14 +418,41 @@ void joymap_free(joymap_t *joymap)
         lib_free(joymap->dev_name);
         lib_free(joymap);
     }
-    if (pstate.fp != NULL) {
-        fclose(pstate.fp);
-        pstate.fp = NULL;
-    }
 }
 
 
+/** \brief  Read whole file into the parser's data buffer
+ *
+ * \param[in]   fp  file pointer
+ *
+ * \return  \c true on success
+ */
+static bool pstate_read_file(FILE *fp)
+{
+    size_t n;
+
+    pstate.datalen = 0;
+    while (true) {
+        /* keep room for the terminating nul */
+        if (pstate.datalen + 1u == pstate.datasize) {
+            pstate.datasize *= 2u;
+            pstate.data = lib_realloc(pstate.data, pstate.datasize);
+        }
+        n = fread(pstate.data + pstate.datalen, 1u,
+                  pstate.datasize - pstate.datalen - 1u, fp);
+        if (n == 0) {
+            break;
+        }
+        pstate.datalen += n;
+    }
+    pstate.data[pstate.datalen] = '\0';
+    return !ferror(fp);
+}
+
 /** \brief  Open file and create new joymap object for it
+ *
+ * The file is read completely, lines are split in place by
+ * \c joymap_read_line().
  *
  * \param[in]   path    path to VJM file
  *
@@ -419,17 +461,26 @@ void joymap_free(joymap_t *joymap)
 static joymap_t *joymap_open(const char *path)
 {
     joymap_t *joymap;
+    FILE     *fp;
 
-    pstate.linenum   = 1;
-    pstate.buffer[0] = '\0';
-    pstate.curpos    = pstate.buffer;
-    pstate.prevpos   = pstate.buffer;
-    pstate.fp        = fopen(path, "r");
+    pstate.linenum = 1;
+    pstate.buffer  = pstate.data;
+    pstate.buflen  = 0;
+    pstate.curpos  = pstate.buffer;
+    pstate.prevpos = pstate.buffer;
 
-    if (pstate.fp == NULL) {
+    fp = fopen(path, "r");
+    if (fp == NULL) {
         msg_error("failed to open vjm file for reading: %s\n", strerror(errno));
         return NULL;
     }
+    if (!pstate_read_file(fp)) {
+        msg_error("failed to read vjm file: %s\n", strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    pstate.next = pstate.data;
 
     joymap = joymap_new();
     joymap->path = lib_strdup(path);
@@ -438,35 +489,34 @@ static joymap_t *joymap_open(const char *path)
 
 /** \brief  Read a line from the joymap
  *
- * \return  \c true on success, \c false on EOF (can indicate failure)
+ * Terminates the next line in the data buffer and strips trailing whitespace.
+ *
+ * \return  \c true on success, \c false on EOF
  */
 static bool joymap_read_line(void)
 {
-    pstate.buflen    = 0;
-    pstate.buffer[0] = '\0';
-    pstate.curpos    = pstate.buffer;
-    pstate.prevpos   = pstate.buffer;
+    char   *end;
+    size_t  remaining;
 
-    while (true) {
-        int ch;
+    remaining = pstate.datalen - (size_t)(pstate.next - pstate.data);
+    if (remaining == 0) {
+        return false;
+    }
 
-        if (pstate.buflen - 1u == pstate.bufsize) {
-            pstate.bufsize *= 2u;
-            pstate.buffer = lib_realloc(pstate.buffer, pstate.bufsize);
-        }
+    pstate.buffer  = pstate.next;
+    pstate.curpos  = pstate.buffer;
+    pstate.prevpos = pstate.buffer;
 
-        ch = fgetc(pstate.fp);
-        if (ch == EOF) {
-            pstate.buffer[pstate.buflen] = '\0';
-            pstate_rtrim();
-            return false;
-        } else if (ch == '\n') {
-            break;
-        }
-        pstate.buffer[pstate.buflen++] = (char)ch;
+    end = memchr(pstate.next, '\n', remaining);
+    if (end != NULL) {
+        *end = '\0';
+        pstate.next = end + 1;
+    } else {
+        /* last line without newline */
+        end = pstate.next + remaining;
+        pstate.next = end;
     }
-
-    pstate.buffer[pstate.buflen] = '\0';
+    pstate.buflen = (size_t)(end - pstate.buffer);
     pstate_rtrim();
     pstate.linenum++;
     return true;
@@ -506,56 +556,54 @@ static keyword_id_t get_keyword(void)
 
 /** \brief  Get string inside double quotes
  *
- * \param[out]  value   string value
+ * The token points into the line buffer. Escaped characters are unescaped in
+ * place, which only happens for strings that contain a backslash.
+ *
+ * \param[out]  token   string value
  *
- * \note    free result with \c lib_free()
+ * \return  \c true on success
  */
-static bool get_quoted_arg(char **value)
+static bool get_quoted_arg(token_t *token)
 {
-    char *result;
-    char *rpos;
+    char *start;
     char *lpos;
-    bool  escaped;
+    char *rpos;
+
+    token->str = NULL;
+    token->len = 0;
 
     if (*pstate.curpos != '"') {
         parser_log_error("expected opening double quote");
-        *value = NULL;
         return false;
     }
 
-    result  = lib_malloc(pstate.buflen - (size_t)(pstate.curpos - pstate.buffer) + 1u);
-    escaped = false;
-    lpos    = pstate.curpos + 1;
-    rpos    = result;
-    while (*lpos != '\0') {
-        if (*lpos == '"') {
-            if (!escaped) {
-                /* end of argument */
-                *rpos  = '\0';
-                *value = result;
-                pstate_update(lpos + 1);
-                return true;
-            } else {
-                *rpos++ = *lpos;
-                escaped = false;
-            }
-        } else if (*lpos == '\\') {
-            if (escaped) {
-                *rpos++ = *lpos;
-                escaped = false;
-            } else {
-                escaped = true;
-            }
-        } else {
-            *rpos++ = *lpos;
-        }
+    start = pstate.curpos + 1;
+    lpos  = start;
+    while (*lpos != '\0' && *lpos != '"' && *lpos != '\\') {
         lpos++;
     }
 
-    parser_log_error("expected closing double quote");
-    lib_free(result);
-    *value = NULL;
-    return false;
+    /* unescape in place, the string can only get shorter */
+    rpos = lpos;
+    while (*lpos == '\\') {
+        if (lpos[1] == '\0') {
+            break;
+        }
+        *rpos++ = lpos[1];
+        lpos   += 2;
+        while (*lpos != '\0' && *lpos != '"' && *lpos != '\\') {
+            *rpos++ = *lpos++;
+        }
+    }
+
+    if (*lpos != '"') {
+        parser_log_error("expected closing double quote");
+        return false;
+    }
+    token->str = start;
+    token->len = (size_t)(rpos - start);
+    pstate_update(lpos + 1);
+    return true;
 }
 
 /** \brief  Get integer argument from current position in line
@@ -623,34 +671,30 @@ static bool get_int_arg(int *value)
 /** \brief  Get action ID from current position in line buffer
  *
  * Get action name (optionally quoted with double quotes) and look up its ID.
- * If \a name is not \c NULL the action name parsed will be stored in \a name,
- * to be freed by the caller with \c lib_free(). This includes action names
- * that match the pattern for action names but for which an ID wasn't found.
- * Any errors during parsing or when looking up an ID will be reported by this
- * function.
+ * If \a name is not \c NULL the action name parsed will be stored in \a name.
+ * This includes action names that match the pattern for action names but for
+ * which an ID wasn't found. Any errors during parsing or when looking up an ID
+ * will be reported by this function.
  *
  * \param[out]  name    action name found, including invalid ones (can be \c NULL)
  *
  * \return  action ID (or \c ACTION_INVALID) when not found
- *
- * \note    free \c name with \c lib_free() if not set to \c NULL
  */
-static int get_ui_action(char **name)
+static int get_ui_action(token_t *name)
 {
-    char   *s;
-    char   *action;
-    size_t  len;
-    int     id;
-    bool    quoted = false;
-
-    len = 0;
-    s   = pstate.curpos;
+    char       *s;
+    const char *action;
+    size_t      len;
+    int         id;
+    bool        quoted = false;
+
+    s = pstate.curpos;
     if (*s == '"') {
         quoted = true;
         s++;
     }
+    action = s;
 
-    //    printf("action name quoted = %s\n", quoted ? "TRUE" : "FALSE");
     while (IS_ACTION_NAME_CHAR(*s)) {
         s++;
     }
@@ -660,31 +704,20 @@ static int get_ui_action(char **name)
         goto exit_err;
     }
 
-    /* copy action name */
-    if (quoted) {
-        /* -1 to account for opening quote */
-        len = (size_t)(s - pstate.curpos - 1);
-    } else {
-        len = (size_t)(s - pstate.curpos);
-    }
+    len = (size_t)(s - action);
     if (len == 0) {
         parser_log_error("missing action name");
         goto exit_err;
     }
 
-    action = lib_malloc(len + 1u);
-    memcpy(action, pstate.curpos + (quoted ? 1 : 0), len);
-    action[len] = '\0';
-
-    id = ui_action_get_id(action);
+    id = ui_action_get_id_len(action, len);
     if (id < ACTION_NONE) {
-        parser_log_error("invalid action name '%s'", action);
+        parser_log_error("invalid action name '%.*s'", (int)len, action);
     }
 
     if (name != NULL) {
-        *name = action;
-    } else {
-        lib_free(action);
+        name->str = action;
+        name->len = len;
     }
 
     if (quoted) {
@@ -698,7 +731,8 @@ static int get_ui_action(char **name)
 
 exit_err:
     if (name != NULL) {
-        *name = NULL;
+        name->str = NULL;
+        name->len = 0;
     }
     return ACTION_INVALID;
 }
@@ -761,17 +795,16 @@ static joy_axis_t *get_axis_and_direction(joymap_t     *joymap,
                                           keyword_id_t *direction)
 {
     joy_axis_t *axis;
-    char       *name;
+    token_t     name;
 
     /* axis name */
     if (!get_quoted_arg(&name)) {
         parser_log_error("expected axis name");
         return NULL;
     }
-    axis = joy_axis_from_name(joymap->joydev, name);
+    axis = joy_axis_from_name_len(joymap->joydev, name.str, name.len);
     if (axis == NULL) {
-        parser_log_error("invalid axis name: '%s'", name);
-        lib_free(name);
+        parser_log_error("invalid axis name: '%.*s'", (int)name.len, name.str);
         return NULL;
     }
 
@@ -781,7 +814,6 @@ static joy_axis_t *get_axis_and_direction(joymap_t     *joymap,
         parser_log_error("expected axis direction ('negative' or 'positive')"
                          " after axis name, got '%s'",
                          pstate.curpos);
-        lib_free(name);
         return NULL;
     }
 
@@ -843,17 +875,16 @@ static joy_calibration_t *get_axis_calibration(joymap_t *joymap)
 static joy_button_t *get_button(joymap_t *joymap)
 {
     joy_button_t *button;
-    char         *name;
+    token_t       name;
 
     if (!get_quoted_arg(&name)) {
         parser_log_error("expected button name");
         return NULL;
     }
-    button = joy_button_from_name(joymap->joydev, name);
+    button = joy_button_from_name_len(joymap->joydev, name.str, name.len);
     if (button == NULL) {
-        parser_log_error("invalid button name: '%s'", name);
+        parser_log_error("invalid button name: '%.*s'", (int)name.len, name.str);
     }
-    lib_free(name);
     return button;
 }
 
@@ -890,17 +921,16 @@ static joy_hat_t *get_hat_and_direction(joymap_t     *joymap,
                                         keyword_id_t *direction)
 {
     joy_hat_t *hat;
-    char      *name;
+    token_t    name;
 
     /* hat name */
     if (!get_quoted_arg(&name)) {
         parser_log_error("expected hat name");
         return NULL;
     }
-    hat = joy_hat_from_name(joymap->joydev, name);
+    hat = joy_hat_from_name_len(joymap->joydev, name.str, name.len);
     if (hat == NULL) {
-        parser_log_error("invalid hat name: '%s'", name);
-        lib_free(name);
+        parser_log_error("invalid hat name: '%.*s'", (int)name.len, name.str);
         return NULL;
     }
 
@@ -913,7 +943,6 @@ static joy_hat_t *get_hat_and_direction(joymap_t     *joymap,
         hat = NULL;
     }
 
-    lib_free(name);
     return hat;
 }
 
@@ -1093,11 +1122,12 @@ static bool handle_action_mapping(joymap_t *joymap)
 {
     joy_mapping_t *mapping;
     int            action_id;
-    char          *action_name = NULL;
+    token_t        action_name;
 
     action_id = get_ui_action(&action_name);
-    msg_debug("action name: %s, action id %d\n", action_name, action_id);
-    lib_free(action_name);
+    msg_debug("action name: %.*s, action id %d\n",
+              (int)action_name.len, action_name.str != NULL ? action_name.str : "",
+              action_id);
     if (action_id < ACTION_NONE) {
         return false;
     }
@@ -1170,7 +1200,7 @@ static bool handle_axis_calibration(joymap_t *joymap)
     while (*pstate.curpos != '\0') {
         switch (get_keyword()) {
             case VJM_KW_THRESHOLD:
-                printf("%s(): got threshold keyword\n", __func__);
+                msg_debug("got threshold keyword\n");
                 if (!get_int_arg(&value)) {
                     parser_log_error("expected integer value for threshold");
                     return false;
@@ -1178,7 +1208,7 @@ static bool handle_axis_calibration(joymap_t *joymap)
                 calibration->threshold = (int32_t)value;
                 break;
             case VJM_KW_DEADZONE:
-                printf("%s(): got deadzone keyword\n", __func__);
+                msg_debug("got deadzone keyword\n");
                 if (!get_int_arg(&value)) {
                     parser_log_error("expected integer value for deadzone");
                     return false;
@@ -1186,7 +1216,7 @@ static bool handle_axis_calibration(joymap_t *joymap)
                 calibration->deadzone = (int32_t)value;
                 break;
             case VJM_KW_FUZZ:
-                printf("%s(): got fuzz keyword\n", __func__);
+                msg_debug("got fuzz keyword\n");
                 if (!get_int_arg(&value)) {
                     parser_log_error("expected integer value for fuzz");
                     return false;
@@ -1199,9 +1229,9 @@ static bool handle_axis_calibration(joymap_t *joymap)
         }
     }
 
-    printf("deadzone  = %d\n", calibration->deadzone);
-    printf("fuzz      = %d\n", calibration->fuzz);
-    printf("threshold = %d\n", calibration->threshold);
+    msg_debug("deadzone  = %d\n", calibration->deadzone);
+    msg_debug("fuzz      = %d\n", calibration->fuzz);
+    msg_debug("threshold = %d\n", calibration->threshold);
 
     return true;
 }
@@ -1246,10 +1276,11 @@ static bool handle_calibration(joymap_t *joymap)
  */
 static bool handle_keyword(joymap_t *joymap, keyword_id_t kw)
 {
-    int   vendor;
-    int   product;
-    int   version;
-    bool  result = true;
+    int      vendor;
+    int      product;
+    int      version;
+    token_t  name;
+    bool     result = true;
 
     if (*pstate.curpos == '\0') {
         parser_log_error("missing data after keyword '%s'", kw_name(kw));
@@ -1299,9 +1330,13 @@ static bool handle_keyword(joymap_t *joymap, keyword_id_t kw)
             break;
 
         case VJM_KW_DEVICE_NAME:
-            if (!get_quoted_arg(&(joymap->dev_name))) {
+            if (!get_quoted_arg(&name)) {
                 result = false;
             } else {
+                lib_free(joymap->dev_name);
+                joymap->dev_name = lib_malloc(name.len + 1u);
+                memcpy(joymap->dev_name, name.str, name.len);
+                joymap->dev_name[name.len] = '\0';
                 msg_debug("got device name '%s'\n", joymap->dev_name);
             }
             break;
@@ -1353,7 +1388,7 @@ static bool joymap_parse_line(joymap_t *joymap)
         parser_log_error("unknown keyword: %s", pstate.curpos);
         return false;
     }
-    printf("found keyword: %d: %s\n", (int)kw, kw_name(kw));
+    msg_debug("found keyword: %d: %s\n", (int)kw, kw_name(kw));
 
     return handle_keyword(joymap, kw);
 }
@@ -1385,18 +1420,17 @@ joymap_t *joymap_load(joy_device_t *joydev, const char *path)
     }
     joymap->joydev = joydev;
 
-    errno          = 0;
     pstate.linenum = 0;
     while (joymap_read_line()) {
         if (!joymap_parse_line(joymap)) {
             joymap_free(joymap);
-            return NULL;
+            joymap = NULL;
+            break;
         }
     }
-    if (errno != 0) {
-        joymap_free(joymap);
-        joymap = NULL;
-    }
+
+    /* mappings (might have) changed, recompile the dispatch program */
+    joy_device_compile_mappings(joydev);
     return joymap;
 }
 
@@ -0,0 +1,115 @@
+/** \file   joyqueue.c
+ * \brief   Lock-free queue of emulated port updates
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Single-producer/single-consumer ring buffer carrying the updates of the
+ * emulated ports from the input thread to the emulation thread.
+ *
+ * We're stuck with C99 so instead of <stdatomic.h> we use the \c __atomic
+ * builtins, which are supported by both GCC and Clang.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "joyqueue.h"
+
+
+/** \brief  Load index written by the other thread */
+#define load_acquire(ptr)       __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+/** \brief  Publish index to the other thread */
+#define store_release(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+/** \brief  Load value only used for statistics or written by the same thread */
+#define load_relaxed(ptr)       __atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+/** \brief  Store value only used for statistics */
+#define store_relaxed(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+
+
+/** \brief  Initialize queue
+ *
+ * Must not be called while either thread is using the queue.
+ *
+ * \param[in]   queue   queue
+ */
+void joy_queue_init(joy_queue_t *queue)
+{
+    memset(queue, 0, sizeof *queue);
+}
+
+/** \brief  Add update to queue
+ *
+ * Must only be called from the producer thread.
+ *
+ * \param[in]   queue   queue
+ * \param[in]   update  port update
+ *
+ * \return  \c false if the queue was full and \a update was dropped
+ */
+bool joy_queue_push(joy_queue_t *queue, const joy_port_update_t *update)
+{
+    uint32_t head = load_relaxed(&queue->head);
+    uint32_t tail = load_acquire(&queue->tail);
+
+    if (head - tail >= JOY_QUEUE_SIZE) {
+        store_relaxed(&queue->dropped, load_relaxed(&queue->dropped) + 1u);
+        return false;
+    }
+    queue->updates[head & (JOY_QUEUE_SIZE - 1u)] = *update;
+    store_relaxed(&queue->pushed, load_relaxed(&queue->pushed) + 1u);
+    store_release(&queue->head, head + 1u);
+    return true;
+}
+
+/** \brief  Remove pending updates from queue
+ *
+ * Copy up to \a max updates, oldest first, into \a updates without waiting
+ * for the producer. Must only be called from the consumer thread.
+ *
+ * \param[in]   queue   queue
+ * \param[out]  updates destination of updates
+ * \param[in]   max     maximum number of updates to copy
+ *
+ * \return  number of updates copied to \a updates
+ */
+size_t joy_queue_drain(joy_queue_t *queue, joy_port_update_t *updates, size_t max)
+{
+    uint32_t tail  = load_relaxed(&queue->tail);
+    uint32_t head  = load_acquire(&queue->head);
+    size_t   count = head - tail;
+
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        updates[i] = queue->updates[(tail + (uint32_t)i) & (JOY_QUEUE_SIZE - 1u)];
+    }
+    store_release(&queue->tail, tail + (uint32_t)count);
+    return count;
+}
+
+/** \brief  Get number of updates added to queue
+ *
+ * \param[in]   queue   queue
+ *
+ * \return  number of updates queued since initialization (wraps around)
+ */
+uint32_t joy_queue_pushed(const joy_queue_t *queue)
+{
+    return load_relaxed(&queue->pushed);
+}
+
+/** \brief  Get number of updates dropped because the queue was full
+ *
+ * \param[in]   queue   queue
+ *
+ * \return  number of updates dropped since initialization (wraps around)
+ */
+uint32_t joy_queue_dropped(const joy_queue_t *queue)
+{
+    return load_relaxed(&queue->dropped);
+}
@@ -0,0 +1,62 @@
+/** \file   joyqueue.h
+ * \brief   Lock-free queue of emulated port updates - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef VICE_JOYQUEUE_H
+#define VICE_JOYQUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "joyapi-types.h"
+
+/** \brief  Number of records in the queue
+ *
+ * Must be a power of two.
+ */
+#define JOY_QUEUE_SIZE      1024u
+
+/** \brief  Size of a cache line, used to keep producer and consumer data apart */
+#define JOY_QUEUE_CACHELINE 64u
+
+/** \brief  Update of emulated input produced by a mapping
+ */
+typedef struct joy_port_update_s {
+    int           port;         /**< emulated port of the device */
+    int32_t       value;        /**< value (1 = press, 0 = release) */
+    joy_mapping_t mapping;      /**< action type and emulated input */
+    uint64_t      timestamp;    /**< time of host event in microseconds
+                                     (0 = unknown) */
+    uint64_t      queued;       /**< time update was queued in microseconds
+                                     (0 when \c timestamp is unknown) */
+} joy_port_update_t;
+
+/** \brief  Single-producer/single-consumer ring of port updates
+ *
+ * The input thread pushes updates, the emulation thread drains them. Neither
+ * side ever blocks or takes a lock: when the ring is full new updates are
+ * dropped and counted.
+ *
+ * The head and tail indexes run freely and are only reduced modulo
+ * \c JOY_QUEUE_SIZE when accessing a record.
+ */
+typedef struct joy_queue_s {
+    /* written by the producer */
+    uint32_t          head;         /**< index of next record to write */
+    uint32_t          pushed;       /**< number of updates queued */
+    uint32_t          dropped;      /**< number of updates dropped on overflow */
+    uint8_t           pad_head[JOY_QUEUE_CACHELINE - 3u * sizeof(uint32_t)];
+    /* written by the consumer */
+    uint32_t          tail;         /**< index of next record to read */
+    uint8_t           pad_tail[JOY_QUEUE_CACHELINE - sizeof(uint32_t)];
+    joy_port_update_t updates[JOY_QUEUE_SIZE];  /**< records */
+} joy_queue_t;
+
+void     joy_queue_init   (joy_queue_t *queue);
+bool     joy_queue_push   (joy_queue_t *queue, const joy_port_update_t *update);
+size_t   joy_queue_drain  (joy_queue_t *queue, joy_port_update_t *updates, size_t max);
+uint32_t joy_queue_pushed (const joy_queue_t *queue);
+uint32_t joy_queue_dropped(const joy_queue_t *queue);
+
+#endif
@@ -0,0 +1,407 @@
+/** \file   joyrecord.c
+ * \brief   Recording of host input events
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Records the input events of the polled devices to a file, so sessions can
+ * be replayed and analyzed without the devices present.
+ *
+ * A recording starts with a header describing the devices: name, node, IDs
+ * and the code, range and name of each axis, button and hat. The header is
+ * followed by fixed-size \c joy_record_t records, one per event.
+ *
+ * Events are recorded from the thread polling the devices, which must never
+ * wait for the disk. So records are put in a lock-free single-producer/
+ * single-consumer ring and written out by a background thread. When the ring
+ * is full, records are dropped and counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#ifdef UNIX_COMPILE
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "joyapi.h"
+#include "lib.h"
+
+#include "joyrecord.h"
+
+
+/** \brief  Maximum number of devices in a recording */
+#define RECORD_MAX_DEVICES  JOY_NUM_PORTS
+
+/** \brief  Microseconds the writer sleeps when there's nothing to write */
+#define WRITER_IDLE_USEC    5000
+
+
+/** \brief  Recorder state */
+static struct {
+    bool                active;     /**< events are being recorded */
+    FILE               *fp;         /**< recording file */
+    const joy_device_t *devices[RECORD_MAX_DEVICES];    /**< recorded devices */
+    int                 num_devices;/**< number of recorded devices */
+    joy_record_t       *ring;       /**< records to write */
+    /* written by the producer */
+    uint32_t            head;       /**< index of next record to add */
+    uint64_t            dropped;    /**< records dropped because ring was full */
+    /* written by the writer */
+    uint32_t            tail;       /**< index of next record to write */
+    uint64_t            written;    /**< records written */
+    bool                failed;     /**< writing failed */
+    bool                stop;       /**< writer must finish */
+#ifdef UNIX_COMPILE
+    pthread_t           thread;     /**< writer thread */
+#endif
+} recorder;
+
+
+/** \brief  Growable buffer for building the header */
+typedef struct header_buffer_s {
+    unsigned char *data;    /**< data */
+    size_t         size;    /**< number of bytes used */
+    size_t         alloc;   /**< number of bytes allocated */
+} header_buffer_t;
+
+/** \brief  Append bytes to header
+ *
+ * \param[in,out]   buf     header buffer
+ * \param[in]       data    bytes to append
+ * \param[in]       size    number of bytes
+ */
+static void put_bytes(header_buffer_t *buf, const void *data, size_t size)
+{
+    if (buf->size + size > buf->alloc) {
+        while (buf->size + size > buf->alloc) {
+            buf->alloc = buf->alloc == 0 ? 1024u : buf->alloc * 2u;
+        }
+        buf->data = lib_realloc(buf->data, buf->alloc);
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+/** \brief  Append 8-bit value to header */
+static void put_u8(header_buffer_t *buf, uint8_t value)
+{
+    put_bytes(buf, &value, sizeof value);
+}
+
+/** \brief  Append 16-bit value to header */
+static void put_u16(header_buffer_t *buf, uint16_t value)
+{
+    put_bytes(buf, &value, sizeof value);
+}
+
+/** \brief  Append 32-bit value to header */
+static void put_u32(header_buffer_t *buf, uint32_t value)
+{
+    put_bytes(buf, &value, sizeof value);
+}
+
+/** \brief  Append signed 32-bit value to header */
+static void put_i32(header_buffer_t *buf, int32_t value)
+{
+    put_bytes(buf, &value, sizeof value);
+}
+
+/** \brief  Append string to header
+ *
+ * Stored as 16-bit length followed by the characters, without terminator.
+ *
+ * \param[in,out]   buf     header buffer
+ * \param[in]       s       string (\c NULL is stored as empty string)
+ */
+static void put_string(header_buffer_t *buf, const char *s)
+{
+    size_t len = s != NULL ? strlen(s) : 0;
+
+    if (len > UINT16_MAX) {
+        len = UINT16_MAX;
+    }
+    put_u16(buf, (uint16_t)len);
+    put_bytes(buf, s, len);
+}
+
+/** \brief  Append device description to header
+ *
+ * \param[in,out]   buf     header buffer
+ * \param[in]       joydev  joystick device
+ */
+static void put_device(header_buffer_t *buf, const joy_device_t *joydev)
+{
+    put_string(buf, joydev->name);
+    put_string(buf, joydev->node);
+    put_u16(buf, joydev->vendor);
+    put_u16(buf, joydev->product);
+    put_u16(buf, joydev->version);
+    put_u32(buf, joydev->num_axes);
+    put_u32(buf, joydev->num_buttons);
+    put_u32(buf, joydev->num_hats);
+
+    for (uint32_t a = 0; a < joydev->num_axes; a++) {
+        const joy_axis_t *axis = &(joydev->axes[a]);
+
+        put_u16(buf, axis->code);
+        put_i32(buf, axis->minimum);
+        put_i32(buf, axis->maximum);
+        put_i32(buf, axis->fuzz);
+        put_i32(buf, axis->flat);
+        put_i32(buf, axis->resolution);
+        put_u8(buf, axis->digital ? 1u : 0u);
+        put_string(buf, axis->name);
+    }
+    for (uint32_t b = 0; b < joydev->num_buttons; b++) {
+        put_u16(buf, joydev->buttons[b].code);
+        put_string(buf, joydev->buttons[b].name);
+    }
+    for (uint32_t h = 0; h < joydev->num_hats; h++) {
+        put_u16(buf, joydev->hats[h].code);
+        put_string(buf, joydev->hats[h].name);
+    }
+}
+
+/** \brief  Write pending records to file
+ *
+ * \return  number of records written
+ */
+static uint32_t write_pending(void)
+{
+    uint32_t tail  = __atomic_load_n(&recorder.tail, __ATOMIC_RELAXED);
+    uint32_t head  = __atomic_load_n(&recorder.head, __ATOMIC_ACQUIRE);
+    uint32_t total = head - tail;
+
+    while (tail != head) {
+        uint32_t index = tail & (JOY_RECORD_RING_SIZE - 1u);
+        uint32_t count = head - tail;
+
+        /* write up to the end of the ring, the rest on the next iteration */
+        if (count > JOY_RECORD_RING_SIZE - index) {
+            count = JOY_RECORD_RING_SIZE - index;
+        }
+        if (!recorder.failed &&
+                fwrite(&(recorder.ring[index]), sizeof *recorder.ring, count,
+                       recorder.fp) != count) {
+            msg_error("failed to write recording: %s\n", strerror(errno));
+            recorder.failed = true;
+        }
+        tail += count;
+        __atomic_store_n(&recorder.tail, tail, __ATOMIC_RELEASE);
+    }
+    if (!recorder.failed) {
+        recorder.written += total;
+    }
+    return total;
+}
+
+#ifdef UNIX_COMPILE
+/** \brief  Writer thread
+ *
+ * Write records to file until asked to stop and the ring is empty.
+ *
+ * \param[in]   arg unused
+ *
+ * \return  \c NULL
+ */
+static void *writer_thread(void *arg)
+{
+    struct timespec idle = { 0, WRITER_IDLE_USEC * 1000L };
+
+    (void)arg;
+    while (true) {
+        bool stop = __atomic_load_n(&recorder.stop, __ATOMIC_ACQUIRE);
+
+        if (write_pending() == 0) {
+            if (stop) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+#endif
+
+
+/** \brief  Start recording events of devices
+ *
+ * Writes the header describing \a devices to \a path and starts recording
+ * their events. Events of other devices are ignored.
+ *
+ * \param[in]   path    path of recording file
+ * \param[in]   devices devices to record
+ * \param[in]   count   number of devices
+ *
+ * \return  \c true on success
+ */
+bool joy_record_start(const char *path, joy_device_t **devices, int count)
+{
+    joy_record_header_t header;
+    header_buffer_t     buf = { NULL, 0, 0 };
+    static const char   padding[8] = { 0 };
+
+    if (recorder.active) {
+        msg_error("already recording\n");
+        return false;
+    }
+    if (count > RECORD_MAX_DEVICES) {
+        msg_error("cannot record more than %d devices\n", RECORD_MAX_DEVICES);
+        return false;
+    }
+
+    recorder.fp = fopen(path, "wb");
+    if (recorder.fp == NULL) {
+        msg_error("failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, JOY_RECORD_MAGIC, sizeof header.magic);
+    header.version     = JOY_RECORD_VERSION;
+    header.byte_order  = JOY_RECORD_BYTE_ORDER;
+    header.num_devices = (uint32_t)count;
+#ifdef WINDOWS_COMPILE
+    header.clock_id    = JOY_RECORD_CLOCK_QPC;
+#else
+    header.clock_id    = JOY_RECORD_CLOCK_MONOTONIC;
+#endif
+    header.start_time  = joy_time_us();
+    put_bytes(&buf, &header, sizeof header);
+    for (int d = 0; d < count; d++) {
+        put_device(&buf, devices[d]);
+        recorder.devices[d] = devices[d];
+    }
+    /* align records for replaying from a memory mapping */
+    put_bytes(&buf, padding, (8u - buf.size % 8u) % 8u);
+    ((joy_record_header_t *)(void *)buf.data)->header_size = (uint32_t)buf.size;
+
+    if (fwrite(buf.data, 1, buf.size, recorder.fp) != buf.size) {
+        msg_error("failed to write %s: %s\n", path, strerror(errno));
+        lib_free(buf.data);
+        fclose(recorder.fp);
+        recorder.fp = NULL;
+        return false;
+    }
+    lib_free(buf.data);
+
+    recorder.num_devices = count;
+    recorder.ring        = lib_malloc(JOY_RECORD_RING_SIZE * sizeof *recorder.ring);
+    recorder.head        = 0;
+    recorder.tail        = 0;
+    recorder.dropped     = 0;
+    recorder.written     = 0;
+    recorder.failed      = false;
+    recorder.stop        = false;
+#ifdef UNIX_COMPILE
+    if (pthread_create(&recorder.thread, NULL, writer_thread, NULL) != 0) {
+        msg_error("failed to create writer thread\n");
+        lib_free(recorder.ring);
+        recorder.ring = NULL;
+        fclose(recorder.fp);
+        recorder.fp = NULL;
+        return false;
+    }
+#endif
+    __atomic_store_n(&recorder.active, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+/** \brief  Stop recording
+ *
+ * Writes the remaining records and closes the file. Must not be called while
+ * devices are being polled.
+ */
+void joy_record_stop(void)
+{
+    if (!recorder.active) {
+        return;
+    }
+    __atomic_store_n(&recorder.active, false, __ATOMIC_RELEASE);
+#ifdef UNIX_COMPILE
+    __atomic_store_n(&recorder.stop, true, __ATOMIC_RELEASE);
+    pthread_join(recorder.thread, NULL);
+#else
+    write_pending();
+#endif
+    if (fclose(recorder.fp) != 0 && !recorder.failed) {
+        msg_error("failed to write recording: %s\n", strerror(errno));
+    }
+    recorder.fp = NULL;
+    lib_free(recorder.ring);
+    recorder.ring        = NULL;
+    recorder.num_devices = 0;
+}
+
+/** \brief  Record event
+ *
+ * Called by the drivers for every event read from the host, before the event
+ * is converted or combined with other events. Does nothing when not recording
+ * or when \a joydev isn't recorded. Never blocks.
+ *
+ * \param[in]   joydev      joystick device
+ * \param[in]   type        input type
+ * \param[in]   code        axis, button or hat code
+ * \param[in]   value       raw axis value, button state or hat directions
+ * \param[in]   timestamp   time of event in microseconds (0 = unknown)
+ */
+void joy_record_event(const joy_device_t *joydev,
+                      joy_input_t         type,
+                      uint16_t            code,
+                      int32_t             value,
+                      uint64_t            timestamp)
+{
+    joy_record_t *record;
+    uint32_t      head;
+    int           device;
+
+    if (!__atomic_load_n(&recorder.active, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    for (device = 0; device < recorder.num_devices; device++) {
+        if (recorder.devices[device] == joydev) {
+            break;
+        }
+    }
+    if (device == recorder.num_devices) {
+        return;
+    }
+
+    head = __atomic_load_n(&recorder.head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&recorder.tail, __ATOMIC_ACQUIRE) >= JOY_RECORD_RING_SIZE) {
+        __atomic_store_n(&recorder.dropped, recorder.dropped + 1u, __ATOMIC_RELAXED);
+        return;
+    }
+    record            = &(recorder.ring[head & (JOY_RECORD_RING_SIZE - 1u)]);
+    record->timestamp = timestamp != 0 ? timestamp : joy_time_us();
+    record->code      = code;
+    record->type      = (uint8_t)type;
+    record->device    = (uint8_t)device;
+    record->value     = value;
+    __atomic_store_n(&recorder.head, head + 1u, __ATOMIC_RELEASE);
+#ifndef UNIX_COMPILE
+    /* no writer thread: rely on stdio buffering */
+    write_pending();
+#endif
+}
+
+/** \brief  Get number of records written to the recording
+ *
+ * \return  number of records written
+ */
+uint64_t joy_record_written(void)
+{
+    return recorder.written;
+}
+
+/** \brief  Get number of records dropped because the writer fell behind
+ *
+ * \return  number of records dropped
+ */
+uint64_t joy_record_dropped(void)
+{
+    return __atomic_load_n(&recorder.dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,83 @@
+/** \file   joyrecord.h
+ * \brief   Recording of host input events - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef VICE_JOYRECORD_H
+#define VICE_JOYRECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "joyapi-types.h"
+
+/** \brief  Recording file magic */
+#define JOY_RECORD_MAGIC        "VJRC"
+
+/** \brief  Recording file format version */
+#define JOY_RECORD_VERSION      3u
+
+/** \brief  Byte order mark, to detect recordings made on another host */
+#define JOY_RECORD_BYTE_ORDER   0x0102u
+
+/** \brief  Clock of the host the recording was made on
+ *
+ * Timestamps are on the \c joy_time_us() clock, unless a driver failed to get
+ * the host's events on that clock. So replays are paced relative to the first
+ * record, not to \c start_time.
+ */
+typedef enum joy_record_clock_e {
+    JOY_RECORD_CLOCK_MONOTONIC = 1, /**< POSIX \c CLOCK_MONOTONIC */
+    JOY_RECORD_CLOCK_QPC       = 2  /**< Windows performance counter */
+} joy_record_clock_t;
+
+/** \brief  Number of records buffered between the producer and the writer
+ *
+ * Must be a power of two.
+ */
+#define JOY_RECORD_RING_SIZE    65536u
+
+/** \brief  Fixed part of the recording header
+ *
+ * Followed by \c num_devices device descriptions and padding up to
+ * \c header_size, after which the records start.
+ */
+typedef struct joy_record_header_s {
+    char     magic[4];      /**< \c JOY_RECORD_MAGIC */
+    uint16_t version;       /**< \c JOY_RECORD_VERSION */
+    uint16_t byte_order;    /**< \c JOY_RECORD_BYTE_ORDER */
+    uint32_t header_size;   /**< offset of first record, multiple of 8 */
+    uint32_t num_devices;   /**< number of devices described */
+    uint32_t clock_id;      /**< clock of \c joy_time_us() (\c joy_record_clock_t) */
+    uint32_t reserved;      /**< padding, 0 */
+    uint64_t start_time;    /**< time recording started in microseconds */
+} joy_record_header_t;
+
+/** \brief  Recorded host input event
+ *
+ * Stored as-is, in host byte order, so recordings can be replayed straight
+ * from a memory mapping.
+ *
+ * Events are recorded by the drivers as reported by the host, before they're
+ * converted or combined: axis values are the raw hardware values, so replays
+ * go through the axis calibration. Hat values are direction bitmasks.
+ */
+typedef struct joy_record_s {
+    uint64_t timestamp;     /**< time of event in microseconds */
+    uint16_t code;          /**< axis, button or hat code */
+    uint8_t  type;          /**< input type (\c joy_input_t) */
+    uint8_t  device;        /**< index of device in the header */
+    int32_t  value;         /**< raw axis value, button state or hat
+                                 directions */
+} joy_record_t;
+
+bool     joy_record_start  (const char *path, joy_device_t **devices, int count);
+void     joy_record_stop   (void);
+void     joy_record_event  (const joy_device_t *joydev,
+                            joy_input_t         type,
+                            uint16_t            code,
+                            int32_t             value,
+                            uint64_t            timestamp);
+uint64_t joy_record_written(void);
+uint64_t joy_record_dropped(void);
+
+#endif
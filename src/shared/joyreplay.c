@@ -0,0 +1,648 @@
+/** \file   joyreplay.c
+ * \brief   Replay of recorded host input events
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * Driver that feeds a recording made with \c --record through the joystick
+ * API as if the recorded devices were connected: the devices are rebuilt from
+ * the recording's header and their events are passed to \c joy_axis_event(),
+ * \c joy_button_event() and \c joy_hat_event(), so the complete mapping
+ * pipeline is exercised without any hardware. Recorded axis values are raw
+ * host values, which are converted with the axis calibration, including the
+ * calibration of a joymap loaded for the device.
+ *
+ * Events are replayed at the recorded speed, at the recorded speed multiplied
+ * by a factor, or as fast as possible, which makes replays usable as
+ * deterministic throughput benchmarks.
+ *
+ * The recording is mapped into memory and the records are used in place, so
+ * even huge recordings don't need to be read or parsed up front. The records
+ * are walked once, by a single cursor shared by all devices: whichever device
+ * is polled replays the due events of all opened devices.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#ifdef UNIX_COMPILE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "joyapi.h"
+#include "joyrecord.h"
+#include "lib.h"
+
+#include "joyreplay.h"
+
+
+/** \brief  Maximum number of events replayed per poll
+ *
+ * Limits the number of port updates queued between two drains of the port
+ * queue when replaying at maximum speed.
+ */
+#define REPLAY_MAX_EVENTS   256u
+
+/** \brief  Maximum number of devices in a recording */
+#define REPLAY_MAX_DEVICES  JOY_NUM_PORTS
+
+
+/** \brief  Replay-specific device data */
+typedef struct replay_hwdata_s {
+    uint8_t  device;    /**< index of device in the recording */
+    bool     opened;    /**< device is opened for polling */
+} replay_hwdata_t;
+
+/** \brief  Replay state */
+static struct {
+    const unsigned char *data;          /**< contents of recording */
+    size_t               size;          /**< size of recording in bytes */
+    bool                 mapped;        /**< \c data is a memory mapping */
+    const joy_record_t  *records;       /**< records in \c data */
+    uint64_t             num_records;   /**< number of records */
+    uint64_t             base;          /**< time of first record */
+    double               speed;         /**< speed factor (0 = maximum) */
+    uint64_t             start;         /**< time replay started (0 = not yet) */
+    uint64_t             events;        /**< number of events replayed */
+    uint64_t             next;          /**< index of next record to replay */
+    joy_device_t        *devices[REPLAY_MAX_DEVICES];   /**< devices not yet
+                                                             handed out */
+    joy_device_t        *opened[REPLAY_MAX_DEVICES];    /**< opened devices by
+                                                             index in recording */
+    uint32_t             num_devices;   /**< number of devices in recording */
+    int                  num_opened;    /**< number of devices opened */
+} replay;
+
+
+/** \brief  Reader for the device descriptions in the header */
+typedef struct header_reader_s {
+    const unsigned char *data;  /**< header data */
+    size_t               size;  /**< size of header */
+    size_t               pos;   /**< read position */
+    bool                 error; /**< read past end of header */
+} header_reader_t;
+
+/** \brief  Read bytes from header
+ *
+ * \param[in,out]   reader  header reader
+ * \param[out]      dest    destination of bytes (set to 0 on error)
+ * \param[in]       size    number of bytes
+ *
+ * \return  \c false when reading past the end of the header
+ */
+static bool get_bytes(header_reader_t *reader, void *dest, size_t size)
+{
+    if (reader->error || size > reader->size - reader->pos) {
+        reader->error = true;
+        memset(dest, 0, size);
+        return false;
+    }
+    memcpy(dest, reader->data + reader->pos, size);
+    reader->pos += size;
+    return true;
+}
+
+/** \brief  Read 8-bit value from header */
+static uint8_t get_u8(header_reader_t *reader)
+{
+    uint8_t value;
+
+    get_bytes(reader, &value, sizeof value);
+    return value;
+}
+
+/** \brief  Read 16-bit value from header */
+static uint16_t get_u16(header_reader_t *reader)
+{
+    uint16_t value;
+
+    get_bytes(reader, &value, sizeof value);
+    return value;
+}
+
+/** \brief  Read 32-bit value from header */
+static uint32_t get_u32(header_reader_t *reader)
+{
+    uint32_t value;
+
+    get_bytes(reader, &value, sizeof value);
+    return value;
+}
+
+/** \brief  Read signed 32-bit value from header */
+static int32_t get_i32(header_reader_t *reader)
+{
+    int32_t value;
+
+    get_bytes(reader, &value, sizeof value);
+    return value;
+}
+
+/** \brief  Read string from header
+ *
+ * \param[in,out]   reader  header reader
+ *
+ * \return  heap-allocated string, empty on error
+ */
+static char *get_string(header_reader_t *reader)
+{
+    uint16_t  len = get_u16(reader);
+    char     *s;
+
+    if (reader->error || len > reader->size - reader->pos) {
+        reader->error = true;
+        return lib_strdup("");
+    }
+    s = lib_malloc((size_t)len + 1u);
+    memcpy(s, reader->data + reader->pos, len);
+    s[len] = '\0';
+    reader->pos += len;
+    return s;
+}
+
+/** \brief  Check if the header holds at least \a count items of \a size bytes
+ *
+ * Guards against allocating huge lists for corrupt counts.
+ *
+ * \param[in,out]   reader  header reader
+ * \param[in]       count   number of items
+ * \param[in]       size    minimum size of an item in bytes
+ *
+ * \return  \c false if the header is too small
+ */
+static bool check_count(header_reader_t *reader, uint32_t count, size_t size)
+{
+    if (reader->error || count > (reader->size - reader->pos) / size) {
+        reader->error = true;
+        return false;
+    }
+    return true;
+}
+
+/** \brief  Rebuild device from its description in the header
+ *
+ * \param[in,out]   reader  header reader
+ * \param[in]       index   index of device in recording
+ *
+ * \return  new device or \c NULL if the description is incomplete
+ */
+static joy_device_t *device_from_header(header_reader_t *reader, uint8_t index)
+{
+    joy_device_t    *joydev = joy_device_new();
+    replay_hwdata_t *hwdata = lib_malloc(sizeof *hwdata);
+    uint32_t         num_axes;
+    uint32_t         num_buttons;
+    uint32_t         num_hats;
+
+    hwdata->device = index;
+    hwdata->opened = false;
+    joydev->hwdata = hwdata;
+
+    joydev->name    = get_string(reader);
+    joydev->node    = get_string(reader);
+    joydev->vendor  = get_u16(reader);
+    joydev->product = get_u16(reader);
+    joydev->version = get_u16(reader);
+    num_axes        = get_u32(reader);
+    num_buttons     = get_u32(reader);
+    num_hats        = get_u32(reader);
+
+    /* code, five ranges, digital flag and name length */
+    if (check_count(reader, num_axes, 2u + 5u * 4u + 1u + 2u) && num_axes > 0) {
+        joydev->axes = lib_malloc(num_axes * sizeof *joydev->axes);
+        for (uint32_t a = 0; a < num_axes; a++) {
+            joy_axis_t *axis = &(joydev->axes[a]);
+
+            joy_axis_init(axis);
+            axis->code       = get_u16(reader);
+            axis->minimum    = get_i32(reader);
+            axis->maximum    = get_i32(reader);
+            axis->fuzz       = get_i32(reader);
+            axis->flat       = get_i32(reader);
+            axis->resolution = get_i32(reader);
+            axis->digital    = get_u8(reader) != 0;
+            axis->name       = get_string(reader);
+            joy_axis_auto_calibrate(axis);
+            joydev->num_axes++;
+        }
+    }
+    /* code and name length */
+    if (check_count(reader, num_buttons, 2u + 2u) && num_buttons > 0) {
+        joydev->buttons = lib_malloc(num_buttons * sizeof *joydev->buttons);
+        for (uint32_t b = 0; b < num_buttons; b++) {
+            joy_button_t *button = &(joydev->buttons[b]);
+
+            joy_button_init(button);
+            button->code = get_u16(reader);
+            button->name = get_string(reader);
+            joydev->num_buttons++;
+        }
+    }
+    if (check_count(reader, num_hats, 2u + 2u) && num_hats > 0) {
+        joydev->hats = lib_malloc(num_hats * sizeof *joydev->hats);
+        for (uint32_t h = 0; h < num_hats; h++) {
+            joy_hat_t *hat = &(joydev->hats[h]);
+
+            joy_hat_init(hat);
+            hat->code = get_u16(reader);
+            hat->name = get_string(reader);
+            joydev->num_hats++;
+        }
+    }
+
+    if (reader->error) {
+        joy_device_free(joydev);
+        return NULL;
+    }
+    return joydev;
+}
+
+/** \brief  Map recording into memory
+ *
+ * Falls back to reading the whole file on hosts without \c mmap().
+ *
+ * \param[in]   path    path of recording
+ *
+ * \return  \c true on success
+ */
+static bool map_file(const char *path)
+{
+#ifdef UNIX_COMPILE
+    struct stat  st;
+    void        *data;
+    int          fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        msg_error("failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX) {
+        msg_error("failed to get size of %s\n", path);
+        close(fd);
+        return false;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        msg_error("failed to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    /* records are read front to back, once */
+    posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    replay.data   = data;
+    replay.size   = (size_t)st.st_size;
+    replay.mapped = true;
+    return true;
+#else
+    unsigned char *data;
+    FILE          *fp;
+    long           size;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        msg_error("failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0 ||
+            fseek(fp, 0, SEEK_SET) != 0) {
+        msg_error("failed to get size of %s\n", path);
+        fclose(fp);
+        return false;
+    }
+    data = lib_malloc((size_t)size);
+    if (fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        msg_error("failed to read %s\n", path);
+        lib_free(data);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    replay.data   = data;
+    replay.size   = (size_t)size;
+    replay.mapped = false;
+    return true;
+#endif
+}
+
+/** \brief  Unmap recording */
+static void unmap_file(void)
+{
+    if (replay.data == NULL) {
+        return;
+    }
+#ifdef UNIX_COMPILE
+    if (replay.mapped) {
+        munmap((void *)(uintptr_t)replay.data, replay.size);
+    } else {
+        lib_free((void *)(uintptr_t)replay.data);
+    }
+#else
+    lib_free((void *)(uintptr_t)replay.data);
+#endif
+    replay.data    = NULL;
+    replay.size    = 0;
+    replay.records = NULL;
+}
+
+
+/** \brief  Open device for replaying
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c true on success
+ */
+static bool replay_open(joy_device_t *joydev)
+{
+    replay_hwdata_t *hwdata = joydev->hwdata;
+
+    if (hwdata == NULL || replay.data == NULL) {
+        return false;
+    }
+    if (!hwdata->opened) {
+        hwdata->opened = true;
+        replay.opened[hwdata->device] = joydev;
+        replay.num_opened++;
+    }
+    return true;
+}
+
+/** \brief  Close replayed device
+ *
+ * \param[in]   joydev  joystick device
+ */
+static void replay_close(joy_device_t *joydev)
+{
+    replay_hwdata_t *hwdata = joydev->hwdata;
+
+    if (hwdata == NULL || !hwdata->opened) {
+        return;
+    }
+    hwdata->opened = false;
+    replay.opened[hwdata->device] = NULL;
+    replay.num_opened--;
+}
+
+/** \brief  Pass recorded event to the joystick API
+ *
+ * Like the host drivers the replay driver records the events it passes on, so
+ * a replay can be recorded again.
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   record  recorded event
+ */
+static void replay_record(joy_device_t *joydev, const joy_record_t *record)
+{
+    joy_record_event(joydev, (joy_input_t)record->type, record->code, record->value, 0);
+
+    switch (record->type) {
+        case JOY_INPUT_AXIS: {
+            joy_axis_t *axis = joy_axis_from_code(joydev, record->code);
+
+            if (axis != NULL) {
+                joy_axis_event(joydev, axis,
+                               joy_axis_value_from_hwdata(axis, record->value));
+            }
+            break;
+        }
+        case JOY_INPUT_BUTTON: {
+            joy_button_t *button = joy_button_from_code(joydev, record->code);
+
+            if (button != NULL) {
+                joy_button_event(joydev, button, record->value);
+            }
+            break;
+        }
+        case JOY_INPUT_HAT: {
+            joy_hat_t *hat = joy_hat_from_code(joydev, record->code);
+
+            if (hat != NULL) {
+                joy_hat_event(joydev, hat, record->value);
+            }
+            break;
+        }
+        default:
+            msg_debug("invalid input type %u\n", (unsigned int)record->type);
+            break;
+    }
+}
+
+/** \brief  Replay events that are due
+ *
+ * Replays the due events of all opened devices, not only those of \a joydev,
+ * so the records are walked once no matter how many devices are replayed.
+ * Records of devices that aren't opened are skipped.
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c false if the device isn't opened
+ */
+static bool replay_poll(joy_device_t *joydev)
+{
+    replay_hwdata_t *hwdata = joydev->hwdata;
+    uint64_t         due    = UINT64_MAX;
+    uint32_t         count  = 0;
+
+    if (hwdata == NULL || !hwdata->opened || replay.records == NULL) {
+        return false;
+    }
+
+    if (replay.start == 0) {
+        replay.start = joy_time_us();
+    }
+    if (replay.speed > 0.0) {
+        /* time in the recording up to which events must have been replayed */
+        due = replay.base +
+              (uint64_t)((double)(joy_time_us() - replay.start) * replay.speed);
+    }
+
+    while (replay.next < replay.num_records && count < REPLAY_MAX_EVENTS) {
+        const joy_record_t *record = &(replay.records[replay.next]);
+        joy_device_t       *owner;
+
+        if (record->timestamp > due) {
+            break;
+        }
+        owner = record->device < REPLAY_MAX_DEVICES ? replay.opened[record->device] : NULL;
+        if (owner != NULL) {
+            replay_record(owner, record);
+            count++;
+        }
+        replay.next++;
+    }
+    replay.events += count;
+    return true;
+}
+
+/** \brief  Free replay-specific device data
+ *
+ * \param[in]   hwdata  replay-specific device data
+ */
+static void replay_hwdata_free(void *hwdata)
+{
+    lib_free(hwdata);
+}
+
+
+/** \brief  Open recording for replaying
+ *
+ * Maps the recording, rebuilds the recorded devices and registers the replay
+ * driver, replacing the arch-specific driver. The devices are obtained with
+ * \c joy_replay_device_list_init() and polled like host devices.
+ *
+ * \param[in]   path    path of recording
+ * \param[in]   speed   speed factor: 1.0 is the recorded speed, 0.0 replays
+ *                      as fast as possible
+ *
+ * \return  \c true on success
+ */
+bool joy_replay_open(const char *path, double speed)
+{
+    joy_record_header_t header;
+    header_reader_t     reader;
+    joy_driver_t        driver = {
+        .open        = replay_open,
+        .close       = replay_close,
+        .poll        = replay_poll,
+        .hwdata_free = replay_hwdata_free
+    };
+
+    if (replay.data != NULL) {
+        msg_error("already replaying\n");
+        return false;
+    }
+    if (!map_file(path)) {
+        return false;
+    }
+
+    if (replay.size < sizeof header) {
+        msg_error("%s: not a recording\n", path);
+        unmap_file();
+        return false;
+    }
+    memcpy(&header, replay.data, sizeof header);
+    if (memcmp(header.magic, JOY_RECORD_MAGIC, sizeof header.magic) != 0) {
+        msg_error("%s: not a recording\n", path);
+        unmap_file();
+        return false;
+    }
+    if (header.byte_order != JOY_RECORD_BYTE_ORDER) {
+        msg_error("%s: recorded on a host with a different byte order\n", path);
+        unmap_file();
+        return false;
+    }
+    if (header.version != JOY_RECORD_VERSION) {
+        msg_error("%s: unsupported version %u\n", path, (unsigned int)header.version);
+        unmap_file();
+        return false;
+    }
+    if (header.header_size < sizeof header || header.header_size > replay.size ||
+            header.header_size % 8u != 0 || header.num_devices > REPLAY_MAX_DEVICES) {
+        msg_error("%s: corrupt header\n", path);
+        unmap_file();
+        return false;
+    }
+
+    /* the driver must be in place before devices can be freed */
+    joy_driver_register(&driver);
+
+    reader.data  = replay.data;
+    reader.size  = header.header_size;
+    reader.pos   = sizeof header;
+    reader.error = false;
+    for (uint32_t d = 0; d < header.num_devices; d++) {
+        joy_device_t *joydev = device_from_header(&reader, (uint8_t)d);
+
+        if (joydev == NULL) {
+            msg_error("%s: corrupt description of device %u\n", path, d);
+            while (d > 0) {
+                joy_device_free(replay.devices[--d]);
+            }
+            unmap_file();
+            return false;
+        }
+        replay.devices[d] = joydev;
+    }
+
+    replay.num_devices = header.num_devices;
+    replay.records     = (const joy_record_t *)(const void *)(replay.data + header.header_size);
+    replay.num_records = (replay.size - header.header_size) / sizeof *replay.records;
+    /* the records can be on another clock than the header's start time */
+    replay.base        = replay.num_records > 0 ? replay.records[0].timestamp : 0;
+    replay.speed       = speed;
+    replay.start       = 0;
+    replay.events      = 0;
+    replay.next        = 0;
+    replay.num_opened  = 0;
+    msg_verbose("%s: %u device%s, %"PRIu64" events, clock %s\n",
+                path, replay.num_devices, replay.num_devices == 1 ? "" : "s",
+                replay.num_records,
+                header.clock_id == JOY_RECORD_CLOCK_MONOTONIC ? "monotonic" :
+                header.clock_id == JOY_RECORD_CLOCK_QPC ? "performance counter" :
+                "unknown");
+    return true;
+}
+
+/** \brief  Close recording
+ *
+ * Frees the devices that weren't handed out with
+ * \c joy_replay_device_list_init(), the others must have been freed already.
+ */
+void joy_replay_close(void)
+{
+    for (uint32_t d = 0; d < replay.num_devices; d++) {
+        if (replay.devices[d] != NULL) {
+            joy_device_free(replay.devices[d]);
+            replay.devices[d] = NULL;
+        }
+    }
+    replay.num_devices = 0;
+    replay.num_records = 0;
+    unmap_file();
+}
+
+/** \brief  Generate list of the recorded devices
+ *
+ * Replaces \c joy_device_list_init() when replaying. The caller owns the
+ * devices and frees them with \c joy_device_list_free().
+ *
+ * \param[out]  devices list of devices
+ *
+ * \return  number of devices in \a devices
+ */
+int joy_replay_device_list_init(joy_device_t ***devices)
+{
+    int count = 0;
+
+    *devices = NULL;
+    for (uint32_t d = 0; d < replay.num_devices; d++) {
+        if (replay.devices[d] != NULL) {
+            count = joy_device_list_add(devices, replay.devices[d]);
+            replay.devices[d] = NULL;
+        }
+    }
+    return count;
+}
+
+/** \brief  Test if all events of the opened devices have been replayed
+ *
+ * \return  \c true when replay is done
+ */
+bool joy_replay_finished(void)
+{
+    return replay.num_opened > 0 && replay.next == replay.num_records;
+}
+
+/** \brief  Get number of events replayed
+ *
+ * \return  number of events passed to the joystick API
+ */
+uint64_t joy_replay_events(void)
+{
+    return replay.events;
+}
@@ -0,0 +1,19 @@
+/** \file   joyreplay.h
+ * \brief   Replay of recorded host input events - header
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+#ifndef VICE_JOYREPLAY_H
+#define VICE_JOYREPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "joyapi-types.h"
+
+bool     joy_replay_open            (const char *path, double speed);
+void     joy_replay_close           (void);
+int      joy_replay_device_list_init(joy_device_t ***devices);
+bool     joy_replay_finished        (void);
+uint64_t joy_replay_events          (void);
+
+#endif
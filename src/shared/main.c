@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <inttypes.h>
 #include <time.h>
 #ifdef WINDOWS_COMPILE
@@ -16,8 +17,12 @@
 #include "config.h"
 #include "lib.h"
 #include "cmdline.h"
+#include "histogram.h"
 #include "joyapi.h"
 #include "joymap.h"
+#include "joyrecord.h"
+#include "joyreplay.h"
+#include "uiactions.h"
 
 
 /** \brief  Enable debug message */
@@ -26,13 +31,32 @@ bool         debug = false;
 /** \brief  Enable more verbose output */
 bool         verbose = false;
 
+/** \brief  Number of threads used to probe devices (0 = automatic) */
+int          probe_threads = 0;
+
+/** \brief  Don't use the device cache, always probe all devices */
+bool         no_device_cache = false;
+
+/** \brief  Directory with input class devices in sysfs (\c NULL = default) */
+char        *sysfs_root = NULL;
+
+/** \brief  Milliseconds to keep nodes open after probing, for reuse when
+ *          opening the device for polling (0 = close immediately)
+ */
+int          probe_fd_timeout = 5000;
+
 static bool  opt_list_devices  = false;
 static bool  opt_list_axes     = false;
 static bool  opt_list_buttons  = false;
 static bool  opt_list_hats     = false;
 static bool  opt_poll_enable   = false;
 static int   opt_poll_interval = 100;
+static char *opt_poll_mode     = NULL;
+static bool  opt_hotplug       = false;
 static char *opt_joymap_file   = NULL;
+static char *opt_record_file   = NULL;
+static char *opt_replay_file   = NULL;
+static char *opt_replay_speed  = NULL;
 
 
 static const cmdline_opt_t options[] = {
@@ -81,6 +105,40 @@ static const cmdline_opt_t options[] = {
         .param      = "msec",
         .help       = "specificy polling interval"
     },
+    {   .type       = CMDLINE_STRING,
+        .long_name  = "poll-mode",
+        .target     = &opt_poll_mode,
+        .param      = "interval|event",
+        .help       = "poll at intervals or in an event-driven input thread"
+    },
+    {   .type       = CMDLINE_INTEGER,
+        .long_name  = "probe-threads",
+        .target     = &probe_threads,
+        .param      = "count",
+        .help       = "number of threads probing devices (0 = automatic)"
+    },
+    {   .type       = CMDLINE_BOOLEAN,
+        .long_name  = "no-device-cache",
+        .target     = &no_device_cache,
+        .help       = "don't use the device cache, probe all devices"
+    },
+    {   .type       = CMDLINE_INTEGER,
+        .long_name  = "probe-fd-timeout",
+        .target     = &probe_fd_timeout,
+        .param      = "msec",
+        .help       = "keep probed devices open for reuse (0 = don't)"
+    },
+    {   .type       = CMDLINE_STRING,
+        .long_name  = "sysfs-root",
+        .target     = &sysfs_root,
+        .param      = "directory",
+        .help       = "directory with input class devices (default /sys/class/input)"
+    },
+    {   .type       = CMDLINE_BOOLEAN,
+        .long_name  = "hotplug",
+        .target     = &opt_hotplug,
+        .help       = "also poll devices plugged in while polling"
+    },
     {   .type       = CMDLINE_STRING,
         .short_name = 'm',
         .long_name  = "joymap",
@@ -88,6 +146,24 @@ static const cmdline_opt_t options[] = {
         .param      = "filename",
         .help       = "load joymap file"
     },
+    {   .type       = CMDLINE_STRING,
+        .long_name  = "record",
+        .target     = &opt_record_file,
+        .param      = "filename",
+        .help       = "record input events of polled devices to file"
+    },
+    {   .type       = CMDLINE_STRING,
+        .long_name  = "replay",
+        .target     = &opt_replay_file,
+        .param      = "filename",
+        .help       = "use devices and events of recording instead of host devices"
+    },
+    {   .type       = CMDLINE_STRING,
+        .long_name  = "replay-speed",
+        .target     = &opt_replay_speed,
+        .param      = "factor",
+        .help       = "replay at factor times the recorded speed (0 = maximum)"
+    },
 
     CMDLINE_OPTIONS_END
 };
@@ -97,6 +173,8 @@ static const cmdline_opt_t options[] = {
 static joy_device_t **devices;
 /** \brief  Number of joystick devices found */
 static int devcount;
+/** \brief  Time device enumeration started in microseconds */
+static uint64_t enumerate_start;
 /** \brief  Non-option arguments (devices to list/poll) */
 static char **args;
 /** \brief  Number of non-option arguments */
@@ -303,11 +381,331 @@ static void sig_handler(int s)
 #endif
 
 
+/** \brief  Devices being polled */
+static joy_device_t *polled[JOY_NUM_PORTS];
+/** \brief  Number of devices being polled */
+static int           num_polled;
+/** \brief  Devices are polled by the input thread */
+static bool          event_mode;
+
+
+/** \brief  Number of action types, for per-action latency statistics */
+#define NUM_ACTIONS (JOY_ACTION_UI_ACTIVATE + 1)
+
+/** \brief  Names of action types in the latency report */
+static const char *action_names[NUM_ACTIONS] = {
+    [JOY_ACTION_NONE]        = "none",
+    [JOY_ACTION_JOYSTICK]    = "joystick",
+    [JOY_ACTION_KEYBOARD]    = "keyboard",
+    [JOY_ACTION_POT_AXIS]    = "pot",
+    [JOY_ACTION_UI_ACTION]   = "ui action",
+    [JOY_ACTION_UI_ACTIVATE] = "ui activate"
+};
+
+/** \brief  Latency between host events and applying their mappings
+ *
+ * The host event time is the kernel's timestamp (evdev) or the driver's
+ * timestamp (SDL), on the \c joy_time_us() clock.
+ */
+static struct {
+    histogram_t  all;                   /**< all updates */
+    histogram_t  ports[JOY_NUM_PORTS];  /**< updates per port */
+    char        *nodes[JOY_NUM_PORTS];  /**< device polled on each port */
+    histogram_t  actions[NUM_ACTIONS];  /**< updates per action type */
+} latency;
+
+/** \brief  Initialize latency statistics */
+static void latency_init(void)
+{
+    histogram_init(&latency.all);
+    for (int port = 0; port < JOY_NUM_PORTS; port++) {
+        histogram_init(&latency.ports[port]);
+        latency.nodes[port] = NULL;
+    }
+    for (int action = 0; action < NUM_ACTIONS; action++) {
+        histogram_init(&latency.actions[action]);
+    }
+}
+
+/** \brief  Free latency statistics */
+static void latency_free(void)
+{
+    for (int port = 0; port < JOY_NUM_PORTS; port++) {
+        lib_free(latency.nodes[port]);
+        latency.nodes[port] = NULL;
+    }
+}
+
+/** \brief  Add latency of port update to statistics
+ *
+ * \param[in]   update  port update
+ */
+static void latency_add(const joy_port_update_t *update)
+{
+    uint64_t delta;
+
+    if (update->timestamp == 0 || update->queued < update->timestamp) {
+        return;
+    }
+    delta = update->queued - update->timestamp;
+    histogram_add(&latency.all, delta);
+    if (update->port >= 0 && update->port < JOY_NUM_PORTS) {
+        histogram_add(&latency.ports[update->port], delta);
+        if (latency.nodes[update->port] == NULL) {
+            for (int i = 0; i < num_polled; i++) {
+                if (polled[i]->port == update->port) {
+                    latency.nodes[update->port] = lib_strdup(polled[i]->node);
+                    break;
+                }
+            }
+        }
+    }
+    if ((int)update->mapping.action < NUM_ACTIONS) {
+        histogram_add(&latency.actions[update->mapping.action], delta);
+    }
+}
+
+/** \brief  Print line of latency report
+ *
+ * \param[in]   label   label of line
+ * \param[in]   hist    latency histogram
+ */
+static void latency_print(const char *label, const histogram_t *hist)
+{
+    printf("  %-24s %8"PRIu64" updates, p50 %6"PRIu64" us, p99 %6"PRIu64" us, "
+           "p99.9 %6"PRIu64" us, max %6"PRIu64" us\n",
+           label, hist->count,
+           histogram_percentile(hist, 50.0),
+           histogram_percentile(hist, 99.0),
+           histogram_percentile(hist, 99.9),
+           hist->maximum);
+}
+
+/** \brief  Print latency statistics
+ *
+ * \param[in]   mode    poll mode
+ */
+static void latency_report(const char *mode)
+{
+    if (latency.all.count == 0) {
+        printf("Latency (%s polling): no updates with timestamps.\n", mode);
+        return;
+    }
+    printf("Latency (%s polling, %d msec interval), host event to port update:\n",
+           mode, opt_poll_interval);
+    latency_print("all", &latency.all);
+    for (int port = 0; port < JOY_NUM_PORTS; port++) {
+        if (latency.ports[port].count > 0) {
+            char label[64];
+
+            snprintf(label, sizeof label, "port %d (%s)", port,
+                     latency.nodes[port] != NULL ? latency.nodes[port] : "?");
+            latency_print(label, &latency.ports[port]);
+        }
+    }
+    for (int action = 0; action < NUM_ACTIONS; action++) {
+        if (latency.actions[action].count > 0) {
+            latency_print(action_names[action], &latency.actions[action]);
+        }
+    }
+}
+
+/** \brief  Print port update taken from the port queue
+ *
+ * \param[in]   update  port update
+ */
+static void print_port_update(const joy_port_update_t *update)
+{
+    const joy_mapping_t *mapping = &(update->mapping);
+    const joy_key_map_t *key     = &(mapping->target.key);
+
+    switch (mapping->action) {
+        case JOY_ACTION_JOYSTICK:
+            printf("event: port %d - JOYSTICK - pin: %d, value: %"PRId32"\n",
+                   update->port, mapping->target.pin, update->value);
+            break;
+        case JOY_ACTION_KEYBOARD:
+            printf("event: port %d - KEYBOARD - row: %d, column: %d, flags: %02x, value: %"PRId32"\n",
+                   update->port, key->row, key->column, key->flags, update->value);
+            break;
+        case JOY_ACTION_POT_AXIS:
+            printf("event: port %d: - POT %c - value: %02"PRIx32"\n",
+                   update->port, mapping->target.pot == JOY_POTX ? 'X' : 'Y',
+                   update->value);
+            break;
+        case JOY_ACTION_UI_ACTION:
+            printf("event: value: %"PRId32", UI ACTION %d (%s)\n",
+                   update->value, mapping->target.ui_action,
+                   ui_action_get_name(mapping->target.ui_action));
+            break;
+        case JOY_ACTION_UI_ACTIVATE:
+            printf("event: UI ACTIVATE\n");
+            break;
+        default:
+            break;
+    }
+}
+
+/** \brief  Drain port queue and print updates
+ *
+ * Does what the emulation thread would do: take all pending updates without
+ * blocking and apply them, which for us means printing them. Also prints the
+ * state of the emulated joystick ports that changed.
+ */
+static void drain_port_queue(void)
+{
+    static uint32_t   dropped = 0;
+    static uint32_t   states[JOY_NUM_PORTS];
+    joy_queue_t      *queue   = joy_port_queue();
+    joy_port_update_t updates[64];
+    size_t            count;
+    uint32_t          total;
+
+    do {
+        count = joy_queue_drain(queue, updates, ARRAY_LEN(updates));
+        for (size_t i = 0; i < count; i++) {
+            latency_add(&updates[i]);
+            print_port_update(&updates[i]);
+        }
+    } while (count == ARRAY_LEN(updates));
+
+    total = joy_queue_dropped(queue);
+    if (total != dropped) {
+        printf("warning: port queue overflow, %"PRIu32" updates dropped\n",
+               total - dropped);
+        dropped = total;
+    }
+
+    for (int port = 0; port < JOY_NUM_PORTS; port++) {
+        uint32_t state = joy_port_read(port);
+
+        if (state != states[port]) {
+            states[port] = state;
+            printf("port %d: state: %03"PRIx32"\n", port, state);
+        }
+    }
+}
+
+
+/** \brief  Open device and start polling it
+ *
+ * Connect \a joydev to the lowest emulated port not used by another device.
+ *
+ * \param[in]   joydev  joystick device
+ *
+ * \return  \c true on success
+ */
+static bool poll_device_add(joy_device_t *joydev)
+{
+    int port;
+
+    if (num_polled == JOY_NUM_PORTS) {
+        fprintf(stderr, "%s: error: cannot poll more than %d devices.\n",
+                cmdline_get_prg_name(), JOY_NUM_PORTS);
+        return false;
+    }
+    for (port = 0; port < JOY_NUM_PORTS; port++) {
+        int d;
+
+        for (d = 0; d < num_polled && polled[d]->port != port; d++) {
+            /* NOP */
+        }
+        if (d == num_polled) {
+            break;
+        }
+    }
+
+    joydev->port = port;
+    printf("Polling device %s on port %d:\n", joydev->node, joydev->port);
+
+    if (!joy_open(joydev)) {
+        fprintf(stderr,
+                "%s: failed to open device %s.\n",
+                cmdline_get_prg_name(), joydev->node);
+        joydev->port = -1;
+        return false;
+    }
+    if (event_mode && joy_thread_active() && !joy_thread_add(joydev)) {
+        fprintf(stderr, "%s: failed to add device %s to input thread.\n",
+                cmdline_get_prg_name(), joydev->node);
+        joy_close(joydev);
+        joydev->port = -1;
+        return false;
+    }
+    polled[num_polled++] = joydev;
+    return true;
+}
+
+/** \brief  Close device and stop polling it
+ *
+ * \param[in]   index   index in the polled devices
+ */
+static void poll_device_remove(int index)
+{
+    joy_device_t *joydev = polled[index];
+
+    joy_close(joydev);
+    joydev->port = -1;
+    polled[index] = polled[--num_polled];
+}
+
+/** \brief  Look up and open the devices to poll
+ *
+ * Open all devices given on the command line and connect each device to its
+ * own emulated port, in the order given.
+ *
+ * \return  \c true on success
+ */
+static bool poll_open_devices(void)
+{
+    for (int i = 0; i < argcount; i++) {
+        joy_device_t *joydev = get_device(args[i]);
+
+        if (joydev == NULL) {
+            fprintf(stderr, "%s: error: could not find device %s.\n",
+                    cmdline_get_prg_name(), args[i]);
+            return false;
+        }
+        if (joydev->port >= 0) {
+            fprintf(stderr, "%s: warning: device %s given more than once.\n",
+                    cmdline_get_prg_name(), args[i]);
+            continue;
+        }
+        if (!poll_device_add(joydev)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** \brief  Handle device plugged in or removed while polling
+ *
+ * \param[in]   joydev  joystick device
+ * \param[in]   added   \a joydev was added (\c false: about to be removed)
+ */
+static void hotplug_callback(joy_device_t *joydev, bool added)
+{
+    if (!added) {
+        printf("Device %s removed.\n", joydev->node);
+        return;
+    }
+
+    printf("Device %s (\"%s\") added.\n", joydev->node, joydev->name);
+    if (joydev->capabilities == JOY_CAPS_NONE) {
+        printf("Device cannot be mapped to emulated input, not polling it.\n");
+    } else {
+        poll_device_add(joydev);
+    }
+}
+
 static int poll_loop(void)
 {
-    joy_device_t    *joydev;
     joymap_t        *joymap = NULL;
     struct timespec  spec;
+    uint64_t         open_start;
+    uint64_t         now;
+    uint64_t         replay_start;
+    bool             recording = false;
 #ifndef WINDOWS_COMPILE
     struct sigaction action = { 0 };
 #endif
@@ -319,26 +717,42 @@ static int poll_loop(void)
         return EXIT_FAILURE;
     }
 
-    /* just the first argument for now */
-    joydev = get_device(args[0]);
-    if (joydev == NULL) {
-        fprintf(stderr, "%s: error: could not find device %s.\n",
-                cmdline_get_prg_name(), args[0]);
-        return EXIT_FAILURE;
+    event_mode = false;
+    if (opt_poll_mode != NULL) {
+        if (strcmp(opt_poll_mode, "event") == 0) {
+            event_mode = true;
+        } else if (strcmp(opt_poll_mode, "interval") != 0) {
+            fprintf(stderr, "%s: error: invalid poll mode '%s'.\n",
+                    cmdline_get_prg_name(), opt_poll_mode);
+            return EXIT_FAILURE;
+        }
     }
 
-    printf("Polling device %s:\n", args[0]);
+    num_polled = 0;
+    latency_init();
+    open_start = joy_time_us();
+    if (!poll_open_devices()) {
+        status = EXIT_FAILURE;
+        goto poll_exit;
+    }
+    now = joy_time_us();
+    msg_verbose("opened %d device%s in %"PRIu64" usec (%"PRIu64" usec after start of enumeration)\n",
+                num_polled, num_polled == 1 ? "" : "s",
+                now - open_start, now - enumerate_start);
 
-    if (!joy_open(joydev)) {
-        fprintf(stderr,
-                "%s: failed to open device %s.\n",
-                cmdline_get_prg_name(), args[0]);
-        return EXIT_FAILURE;
+    if (opt_record_file != NULL) {
+        if (!joy_record_start(opt_record_file, polled, num_polled)) {
+            status = EXIT_FAILURE;
+            goto poll_exit;
+        }
+        printf("Recording input events to %s.\n", opt_record_file);
+        recording = true;
     }
 
     if (opt_joymap_file != NULL) {
+        /* the joymap is applied to the first device */
         printf("Loading joymap file %s.\n", opt_joymap_file);
-        joymap = joymap_load(joydev, opt_joymap_file);
+        joymap = joymap_load(polled[0], opt_joymap_file);
         if (joymap == NULL) {
             fprintf(stderr, "Failed!\n");
         } else {
@@ -358,11 +772,77 @@ static int poll_loop(void)
     sigaction(SIGINT, &action, NULL);
 #endif
 
+    if (opt_hotplug && !joy_hotplug_start()) {
+        fprintf(stderr, "%s: failed to start hotplug detection.\n",
+                cmdline_get_prg_name());
+        status = EXIT_FAILURE;
+        goto poll_exit;
+    }
+
+    replay_start = joy_time_us();
+    if (event_mode) {
+        /* the input thread polls the devices as soon as they have events, we
+         * only consume the port updates at the polling interval, like the
+         * emulation thread would once per frame */
+        if (!joy_thread_start(polled, (size_t)num_polled)) {
+            fprintf(stderr, "%s: failed to start input thread.\n",
+                    cmdline_get_prg_name());
+            status = EXIT_FAILURE;
+            goto poll_exit;
+        }
+    }
+
     while (true) {
-        if (!joy_poll(joydev)) {
+        if (event_mode) {
+            if (!joy_thread_active()) {
+                status = EXIT_FAILURE;
+                goto poll_exit;
+            }
+            /* close the devices the input thread dropped */
+            for (int i = 0; i < num_polled; ) {
+                if (joy_thread_lost(polled[i])) {
+                    fprintf(stderr, "%s: error polling device %s, dropping it.\n",
+                            cmdline_get_prg_name(), polled[i]->node);
+                    poll_device_remove(i);
+                } else {
+                    i++;
+                }
+            }
+        } else {
+            /* poll all devices, dropping the ones that fail (unplugged) */
+            for (int i = 0; i < num_polled; ) {
+                if (joy_poll(polled[i])) {
+                    i++;
+                } else {
+                    fprintf(stderr, "%s: error polling device %s, dropping it.\n",
+                            cmdline_get_prg_name(), polled[i]->node);
+                    poll_device_remove(i);
+                }
+            }
+        }
+        if (num_polled == 0 && !opt_hotplug) {
             status = EXIT_FAILURE;
             goto poll_exit;
         }
+        drain_port_queue();
+        if (opt_replay_file != NULL && joy_replay_finished()) {
+            uint64_t elapsed = joy_time_us() - replay_start;
+            uint64_t events  = joy_replay_events();
+
+            printf("Replayed %"PRIu64" events in %"PRIu64" usec (%.0f events/sec).\n",
+                   events, elapsed,
+                   elapsed > 0 ? (double)events * 1e6 / (double)elapsed : 0.0);
+            status = EXIT_SUCCESS;
+            goto poll_exit;
+        }
+        if (opt_hotplug) {
+            int count = joy_hotplug_poll(&devices, hotplug_callback);
+
+            if (count >= 0) {
+                devcount = count;
+            }
+        }
+        joy_device_list_idle(devices);
         if (stop_polling) {
             printf("Caught SIGINT, stopping polling\n");
             status = EXIT_SUCCESS;
@@ -374,8 +854,24 @@ static int poll_loop(void)
     }
 
 poll_exit:
+    if (event_mode) {
+        joy_thread_stop();
+    }
+    if (opt_hotplug) {
+        joy_hotplug_stop();
+    }
+    if (recording) {
+        joy_record_stop();
+        printf("Recorded %"PRIu64" events, dropped %"PRIu64".\n",
+               joy_record_written(), joy_record_dropped());
+    }
+    drain_port_queue();
+    latency_report(event_mode ? "event" : "interval");
+    latency_free();
     joymap_free(joymap);
-    joy_close(joydev);
+    while (num_polled > 0) {
+        poll_device_remove(num_polled - 1);
+    }
     return status;
 }
 
@@ -414,8 +910,32 @@ int main(int argc, char **argv)
     /* initialize joymap parser */
     joymap_module_init();
 
-    /* enumerate connected devices */
-    devcount = joy_device_list_init(&devices);
+    enumerate_start = joy_time_us();
+    if (opt_replay_file != NULL) {
+        /* replace host devices with the recorded devices */
+        double  speed = 1.0;
+        char   *endptr;
+
+        if (opt_replay_speed != NULL) {
+            speed = strtod(opt_replay_speed, &endptr);
+            if (endptr == opt_replay_speed || *endptr != '\0' || speed < 0.0) {
+                fprintf(stderr, "%s: error: invalid replay speed '%s'.\n",
+                        cmdline_get_prg_name(), opt_replay_speed);
+                status = EXIT_FAILURE;
+                goto cleanup;
+            }
+        }
+        if (!joy_replay_open(opt_replay_file, speed)) {
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        devcount = joy_replay_device_list_init(&devices);
+    } else {
+        /* enumerate connected devices */
+        devcount = joy_device_list_init(&devices);
+        msg_verbose("enumerated devices in %"PRIu64" usec\n",
+                    joy_time_us() - enumerate_start);
+    }
     if (devcount == 0) {
         printf("No devices found.\n");
         goto cleanup;
@@ -487,9 +1007,15 @@ int main(int argc, char **argv)
 
 cleanup:
     joy_device_list_free(devices);
+    joy_replay_close();
     joymap_module_shutdown();
     joy_shutdown();
     cmdline_free();
     lib_free(opt_joymap_file);
+    lib_free(opt_record_file);
+    lib_free(opt_replay_file);
+    lib_free(opt_replay_speed);
+    lib_free(opt_poll_mode);
+    lib_free(sysfs_root);
     return status;
 }
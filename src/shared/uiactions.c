@@ -458,6 +458,34 @@ int ui_action_get_id(const char *name)
 }
 
 
+/** \brief  Get action ID by name of given length
+ *
+ * Like \c ui_action_get_id() for names that aren't nul-terminated, such as
+ * tokens in a line buffer.
+ *
+ * \param[in]   name    action name (doesn't need to be nul-terminated)
+ * \param[in]   len     length of \a name
+ *
+ * \return  ID or -1 when not found
+ */
+int ui_action_get_id_len(const char *name, size_t len)
+{
+    if (name != NULL && len > 0) {
+        int i = 0;
+
+        while (action_info_list[i].id > ACTION_NONE) {
+            const char *s = action_info_list[i].name;
+
+            if (strncmp(s, name, len) == 0 && s[len] == '\0') {
+                return action_info_list[i].id;
+            }
+            i++;
+        }
+    }
+    return ACTION_INVALID;
+}
+
+
 /** \brief  Get action name by ID
  *
  * \param[in]   action  UI action ID
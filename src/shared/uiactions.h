@@ -403,6 +403,7 @@ enum {
 
 /* Action info getters */
 int                     ui_action_get_id       (const char *name);
+int                     ui_action_get_id_len   (const char *name, size_t len);
 const char *            ui_action_get_name     (int action);
 const char *            ui_action_get_desc     (int action);
 
@@ -8,6 +8,7 @@
 #include "config.h"
 #include "lib.h"
 #include "joyapi.h"
+#include "joyrecord.h"
 
 
 /** \brief  Iterator used for the devices enumerator callback */
@@ -420,6 +421,7 @@ static bool joydev_poll(joy_device_t *joydev)
 
         /* trigger button event if the state changed */
         if (button->prev != newval) {
+            joy_record_event(joydev, JOY_INPUT_BUTTON, button->code, newval, 0);
             joy_button_event(joydev, button, newval),
             button->prev = newval;
         }
@@ -432,6 +434,7 @@ static bool joydev_poll(joy_device_t *joydev)
         int32_t     newval = (int32_t)*value;
 
         if (newval != axis->prev) {
+            joy_record_event(joydev, JOY_INPUT_AXIS, axis->code, newval, 0);
             joy_axis_event(joydev, axis, newval);
             axis->prev = newval;
         }
@@ -465,6 +468,10 @@ static bool joydev_poll(joy_device_t *joydev)
             direction = JOYSTICK_DIRECTION_LEFT|JOYSTICK_DIRECTION_UP;
         }
 
+        /* the state is polled, only record changes */
+        if ((hat->prev & 0x0f) != direction) {
+            joy_record_event(joydev, JOY_INPUT_HAT, hat->code, direction, 0);
+        }
         joy_hat_event(joydev, hat, direction);
     }
     return true;